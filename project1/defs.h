@@ -1,10 +1,15 @@
 struct buf;
 struct context;
+struct cpu;
 struct file;
 struct inode;
+struct MLFQ;
 struct pipe;
 struct proc;
+struct procq;
 struct rtcdate;
+struct schedconf;
+struct schedstat;
 struct spinlock;
 struct sleeplock;
 struct stat;
@@ -77,6 +82,7 @@ void            cmostime(struct rtcdate *r);
 int             lapicid(void);
 extern volatile uint*    lapic;
 void            lapiceoi(void);
+void            lapicipi(int, int);
 void            lapicinit(void);
 void            lapicstartap(uchar, uint);
 void            microdelay(int);
@@ -102,22 +108,49 @@ int             piperead(struct pipe*, char*, int);
 int             pipewrite(struct pipe*, char*, int);
 
 // mlfq.c
-void            L0_push(struct proc* p);
-void            L1_push(struct proc* p);
-void            L2_push(struct proc* p);
-struct proc*    L0_pop(void);
-struct proc*    L1_pop(void);
-struct proc*    L2_pop(void);
-void            upper_heapify(uint cur_index);
-void            lower_heapify(uint cur_index);
-void            heapify(uint cur_index);
-int             L2_find(uint pid, int cur_index);
-int             L0_scheduling(void);
-int             L1_scheduling(void);
-int             L2_scheduling(void);
+void            mlfqinit(void);
+void            L0_push(struct MLFQ* q, struct proc* p);
+void            L0_push_front(struct MLFQ* q, struct proc* p);
+void            L1_push(struct MLFQ* q, struct proc* p);
+void            L2_push(struct MLFQ* q, struct proc* p);
+void            L2_requeue(struct MLFQ* q, struct proc* p);
+struct proc*    L0_pop(struct MLFQ* q);
+struct proc*    L1_pop(struct MLFQ* q);
+struct proc*    L2_pop(struct MLFQ* q);
+void            procq_push(struct procq* pq, struct proc* p);
+void            procq_push_front(struct procq* pq, struct proc* p);
+void            procq_remove(struct proc* p);
+void            procq_splice(struct procq* dst, struct procq* src);
+void            dequeue(struct proc* p);
+struct proc*    mlfq_next(struct cpu* c);
+void            runproc(struct proc* p);
+int             L0_scheduling(struct MLFQ* q);
+int             L1_scheduling(struct MLFQ* q);
+int             L2_scheduling(struct MLFQ* q);
 void            enqueue(struct proc* p);
+void            handoff(struct proc* p);
+struct proc*    takehandoff(struct cpu* c);
+void            mlfq_push(struct MLFQ* q, struct proc* p);
+uint            toplevel(void);
+uint            nextlevel(uint l);
+uint            boostepoch(int cpu);
+int             mlfq_setconf(struct schedconf* sc);
+void            mlfq_getconf(struct schedconf* sc);
+int             boostproc(struct proc* p, uint epoch);
+void            mlfq_boost(struct MLFQ* q, uint epoch);
+void            endlock(struct proc* p);
+int             reserve(struct proc* p);
+void            unreserve(struct proc* p);
+void            charge(struct proc* p);
+void            latency(struct MLFQ* q, uint level, uint64 cycles);
+struct MLFQ*    procqueue(struct proc* p);
+int             mlfq_haswork(struct MLFQ* q);
+int             mlfq_steal(struct MLFQ* q);
+int             mlfq_kick(struct MLFQ* q);
+void            mlfq_preempt(struct MLFQ* q, struct proc* p);
+int             resched(void);
+void            kickcpu(struct cpu* c);
 int             getLevel(void);
-extern struct MLFQ mlfq;
 
 //PAGEBREAK: 16
 // proc.c
@@ -125,6 +158,7 @@ int             cpuid(void);
 void            exit(void);
 int             fork(void);
 int             growproc(int);
+void            finishswitch(void);
 int             kill(int);
 struct cpu*     mycpu(void);
 struct proc*    myproc();
@@ -134,15 +168,21 @@ void            scheduler(void) __attribute__((noreturn));
 struct proc*    verifyProc(uint password);
 void            schedulerLock(uint password);
 void            schedulerUnlock(uint password);
+int             reservecpu(void);
+int             releasecpu(void);
+void            unlockcpu(void);
 void            sched(void);
 void            setproc(struct proc*);
 void            sleep(void*, struct spinlock*);
 void            userinit(void);
 int             wait(void);
 void            wakeup(void*);
+void            wakeupto(void*);
 void            yield(void);
-void            setPriority(uint pid, uint priority);
-void            priorityBoosting(struct proc* p);
+void            setstate(struct proc*, int);
+int             schedstat(int pid, struct schedstat* st);
+int             schedconf(struct schedconf* set, struct schedconf* old);
+int             setPriority(uint pid, uint priority);
 
 // swtch.S
 void            swtch(struct context**, struct context*);
@@ -185,6 +225,7 @@ void            timerinit(void);
 // trap.c
 void            idtinit(void);
 extern uint     ticks;
+extern uint     tickcycles;
 void            tvinit(void);
 extern struct spinlock tickslock;
 
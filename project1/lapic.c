@@ -113,6 +113,16 @@ lapiceoi(void)
     lapicw(EOI, 0);
 }
 
+// Send interrupt vector to the cpu with the given APIC ID.
+void
+lapicipi(int apicid, int vector)
+{
+  lapicw(ICRHI, apicid<<24);
+  lapicw(ICRLO, FIXED | ASSERT | vector);
+  while(lapic[ICRLO] & DELIVS)
+    ;
+}
+
 // Spin for a given number of microseconds.
 // On real hardware would want to tune this dynamically.
 void
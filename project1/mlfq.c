@@ -4,163 +4,286 @@
 #include "memlayout.h"
 #include "mmu.h"
 #include "x86.h"
-#include "proc.h"
+#include "traps.h"
 #include "spinlock.h"
+#include "proc.h"
+#include "schedstat.h"
+#include "schedconf.h"
 #include "mlfq.h"
 
-struct MLFQ mlfq;
+struct MLFQ mlfqs[NCPU];
+struct mlfqconf mlfqconf;
+static struct spinlock conflock;
 
-//push and pop L0,L1 in circular queue
+// give every cpu its own ready queues, start with the
+// compiled-in tunables
 void
-L0_push(struct proc* p) {
-  mlfq.L0_proc[mlfq.L0_end++] = p;
-	mlfq.L0_end %= LNPROC;
+mlfqinit(void)
+{
+  int i;
+
+  for(i = 0; i < ncpu; i++) {
+    cpus[i].mlfq = &mlfqs[i];
+    initlock(&mlfqs[i].lock, "mlfq");
+  }
+  initlock(&conflock, "mlfqconf");
+  mlfqconf.nlevel = NCONFLEVEL;
+  mlfqconf.quantum[0] = L0TIMEMAX;
+  mlfqconf.quantum[1] = L1TIMEMAX;
+  mlfqconf.quantum[2] = L2TIMEMAX;
+  mlfqconf.policy = L2PRIORITY;
+  mlfqconf.boostticks = BOOSTTICKS;
+  mlfqconf.stagger = BOOSTSTAGGER;
+  mlfqconf.direct = 1;
 }
 
-struct proc*
-L0_pop() {
-  struct proc* p = mlfq.L0_proc[mlfq.L0_start++];
-  mlfq.L0_start %= LNPROC;
-  return p;
+//append to the tail of an intrusive process list
+void
+procq_push(struct procq* pq, struct proc* p) {
+  p->next = 0;
+  p->prev = pq->tail;
+  if(pq->tail) pq->tail->next = p;
+  else pq->head = p;
+  pq->tail = p;
+  p->rq = pq;
 }
 
+//insert at the head of an intrusive process list
 void
-L1_push(struct proc* p) {
-  mlfq.L1_proc[mlfq.L1_end++] = p;
-	mlfq.L1_end %= LNPROC;
+procq_push_front(struct procq* pq, struct proc* p) {
+  p->prev = 0;
+  p->next = pq->head;
+  if(pq->head) pq->head->prev = p;
+  else pq->tail = p;
+  pq->head = p;
+  p->rq = pq;
 }
 
-struct proc*
-L1_pop() {
-  struct proc* p = mlfq.L1_proc[mlfq.L1_start++];
-  mlfq.L1_start %= LNPROC;
-  return p;
+//unlink process from the list it is on
+void
+procq_remove(struct proc* p) {
+  struct procq* pq = p->rq;
+
+  if(p->prev) p->prev->next = p->next;
+  else pq->head = p->next;
+  if(p->next) p->next->prev = p->prev;
+  else pq->tail = p->prev;
+  p->next = p->prev = 0;
+  p->rq = 0;
 }
 
+//move every process of src to the tail of dst
 void
-upper_heapify(uint cur_index) {
-  uint parent_index = cur_index/2;
-  struct proc* cur_p,* parent_p;
+procq_splice(struct procq* dst, struct procq* src) {
+  struct proc* p;
+
+  if(src->head == 0) return;
+  for(p = src->head; p; p = p->next)
+    p->rq = dst;
+  src->head->prev = dst->tail;
+  if(dst->tail) dst->tail->next = src->head;
+  else dst->head = src->head;
+  dst->tail = src->tail;
+  src->head = src->tail = 0;
+}
 
-  while(cur_index != 1) {
-    cur_p = mlfq.L2_proc[cur_index];
-    parent_p = mlfq.L2_proc[cur_index/2];
+//take process out of the ready queue it is on.
+//p->cpu names the cpu whose queues hold it while p->rq is set.
+//a process is only queued and moved under its lock, which the
+//caller holds, but a pop may take it off meanwhile.
+void
+dequeue(struct proc* p) {
+  struct MLFQ* q;
+
+  if(p->rq == 0) return;
+  q = cpus[p->cpu].mlfq;
+  acquire(&q->lock);
+  if(p->rq) {
+    procq_remove(p);
+    q->nready--;
+  }
+  release(&q->lock);
+}
 
-    if(cur_p->priority > parent_p->priority || (cur_p->priority == parent_p->priority && cur_p->time_enter > parent_p->time_enter)) 
-      break;
+//put process on one of q's lists, leaving any list it was on.
+//caller holds p->lock.
+static void
+push(struct MLFQ* q, struct procq* pq, struct proc* p, int front) {
+  dequeue(p);
+  acquire(&q->lock);
+  if(front)
+    procq_push_front(pq, p);
+  else
+    procq_push(pq, p);
+  p->cpu = q - mlfqs;
+  q->nready++;
+  release(&q->lock);
+}
 
-    mlfq.L2_proc[cur_index] = parent_p;
-    mlfq.L2_proc[parent_index] = cur_p;
-    cur_index = parent_index;
-    parent_index = cur_index/2;
+//pop the head of one of q's lists, 0 if empty.
+//the process is not locked: it is only RUNNABLE until the
+//caller takes p->lock, and nothing else can pop it meanwhile.
+//whoever moves a queued process checks p->rq under q->lock
+//(see dequeue, L2_requeue), so it is not put back either.
+static struct proc*
+pop(struct MLFQ* q, struct procq* pq) {
+  struct proc* p;
+
+  acquire(&q->lock);
+  if((p = pq->head) != 0) {
+    procq_remove(p);
+    q->nready--;
   }
+  release(&q->lock);
+  return p;
 }
 
+//push and pop L0,L1 in FIFO order
 void
-lower_heapify(uint cur_index) {
-  struct proc* cur_p;
-  uint smaller_child_index;
-  while(cur_index < mlfq.L2_size) {
-    cur_p = mlfq.L2_proc[cur_index];
-    smaller_child_index = cur_index;
-
-    if((2*cur_index <= mlfq.L2_size &&
-      mlfq.L2_proc[2*cur_index]->priority < cur_p->priority) ||
-      (2*cur_index+1 <= mlfq.L2_size && mlfq.L2_proc[2*cur_index]->priority == cur_p->priority && 
-      mlfq.L2_proc[2*cur_index]->time_enter < cur_p->time_enter) ) 
-      {
-        smaller_child_index = 2*cur_index;
-      }
-
-    if((2*cur_index+1 <= mlfq.L2_size &&
-      mlfq.L2_proc[2*cur_index+1]->priority < mlfq.L2_proc[smaller_child_index]->priority) ||
-      (2*cur_index+1 <= mlfq.L2_size && mlfq.L2_proc[2*cur_index+1]->priority == mlfq.L2_proc[smaller_child_index]->priority && 
-      mlfq.L2_proc[2*cur_index+1]->time_enter < mlfq.L2_proc[smaller_child_index]->time_enter)) 
-      {
-        smaller_child_index = 2*cur_index+1;
-      }
-    if(smaller_child_index == cur_index) break;
-    
-    struct proc* temp = cur_p;
-    mlfq.L2_proc[cur_index] = mlfq.L2_proc[smaller_child_index];
-    mlfq.L2_proc[smaller_child_index] = temp;
-
-    cur_index = smaller_child_index;
-  }
+L0_push(struct MLFQ* q, struct proc* p) {
+  push(q, &q->L0, p, 0);
 }
 
+//push to the head of L0, it runs next
 void
-heapify(uint cur_index) {
-  upper_heapify(cur_index);
-  lower_heapify(cur_index);
-} 
+L0_push_front(struct MLFQ* q, struct proc* p) {
+  push(q, &q->L0, p, 1);
+}
+
+struct proc*
+L0_pop(struct MLFQ* q) {
+  return pop(q, &q->L0);
+}
 
-//push to leaf element and heapify.
-//sort by priority, enter_time
 void
-L2_push(struct proc* p) {
-  mlfq.L2_proc[++mlfq.L2_size] = p;
-  upper_heapify(mlfq.L2_size);
+L1_push(struct MLFQ* q, struct proc* p) {
+  push(q, &q->L1, p, 0);
 }
 
-//pop root element and heapify remain elements.
 struct proc*
-L2_pop(void) {
-  struct proc* pop_p = mlfq.L2_proc[1];
-  mlfq.L2_proc[1] = mlfq.L2_proc[mlfq.L2_size--];
-  lower_heapify(1);
-  return pop_p;
+L1_pop(struct MLFQ* q) {
+  return pop(q, &q->L1);
 }
 
-// find index with pid in L2
-int
-L2_find(uint pid, int cur_index) {
-  struct proc* p = mlfq.L2_proc[cur_index];
-  int ret = 0;
-  if(p->pid == pid) return cur_index;
-
-  if(2*cur_index <= mlfq.L2_size) {
-    ret = L2_find(pid, 2*cur_index);
-    if(ret) return ret;
-  }
-  if(2*cur_index+1 <= mlfq.L2_size) {
-    ret = L2_find(pid, 2*cur_index+1);
-    if(ret) return ret;
+//move p, if it is still waiting in L2, to the tail of the
+//FIFO of its current priority. a pop may take p off its queue
+//until q->lock is held, so that is where rq is checked.
+//q holds p's queues; caller holds p->lock.
+void
+L2_requeue(struct MLFQ* q, struct proc* p) {
+  acquire(&q->lock);
+  if(p->rq && p->mlfq_level == 2) {
+    procq_remove(p);
+    if(mlfqconf.policy == L2ROUNDROBIN)
+      procq_push(&q->L2[0], p);
+    else
+      procq_push(&q->L2[p->priority], p);
   }
+  release(&q->lock);
+}
 
-  return ret;
+//push to the tail of its priority's FIFO.
+//same priority runs in order of entering.
+//round robin policy keeps everything in the first FIFO.
+void
+L2_push(struct MLFQ* q, struct proc* p) {
+  if(mlfqconf.policy == L2ROUNDROBIN)
+    push(q, &q->L2[0], p, 0);
+  else
+    push(q, &q->L2[p->priority], p, 0);
 }
 
-//scheduling in L0 queue, return executed processes count
-int
-L0_scheduling(void) {
-  struct proc *p;
+//pop head of the smallest non-empty priority
+struct proc*
+L2_pop(struct MLFQ* q) {
+  struct proc* p;
+  int i;
+
+  for(i = 0; i < L2PRIO; i++)
+    if(q->L2[i].head && (p = pop(q, &q->L2[i])) != 0)
+      return p;
+  return 0;
+}
+
+// make p the process running on cpu c. caller holds p->lock.
+static void
+setrunning(struct cpu* c, struct proc* p) {
+  uint epoch = boostepoch(c-cpus);
+
+  // a boost generation began: the rest of L1/L2 now runs after L0
+  if(c->mlfq->epoch != epoch)
+    mlfq_boost(c->mlfq, epoch);
+  boostproc(p, epoch);
+  if(p->woken) {
+    latency(c->mlfq, p->mlfq_level, rdtsc() - p->stamp);
+    p->woken = 0;
+  }
+  p->nswitch++;
+  c->mlfq->nswitch++;
+  p->cpu = c-cpus;
+  c->proc = p;
+  c->resched = 0;
+  c->handoff = 0;
+  switchuvm(p);
+  setstate(p, RUNNING);
+}
+
+// Switch to chosen process, popped off a ready queue.
+// It is the process's job to release p->lock and then
+// reacquire it before jumping back to us.
+void
+runproc(struct proc* p) {
   struct cpu *c = mycpu();
-  int proc_cnt = 0, index = 0;
+
+  acquire(&p->lock);
+  if(p->state != RUNNABLE)
+    panic("runproc");
+  setrunning(c, p);
+  swtch(&(c->scheduler), p->context);
+  switchkvm();
+
+  // Process is done running for now.
+  // It should have changed its p->state before coming back.
   c->proc = 0;
+  finishswitch();
+}
 
-  while(mlfq.L0_start != mlfq.L0_end){
-    index = mlfq.L0_start;
-    p = L0_pop();
+// pick the next process of cpu c's own queues and make it the
+// running one, for sched() to switch to without going through
+// the scheduler loop. return 0 if the queues are empty or the
+// fast path is off; the scheduler then steals or idles.
+// the process switching away, c->prev, holds its own lock; the
+// one returned is locked too, for it to release once running.
+struct proc*
+mlfq_next(struct cpu* c) {
+  struct MLFQ* q = c->mlfq;
+  struct proc* p;
+
+  if(!mlfqconf.direct)
+    return 0;
+  if((p = takehandoff(c)) == 0 &&
+     (p = L0_pop(q)) == 0 &&
+     (p = L1_pop(q)) == 0 &&
+     (p = L2_pop(q)) == 0)
+    return 0;
+  if(p != c->prev)
+    acquire(&p->lock);
+  setrunning(c, p);
+  return p;
+}
 
-    if(p->state != RUNNABLE) {
-      mlfq.L0_proc[index] = 0;
-      continue;
-    }
-    // Switch to chosen process.  It is the process's job
-    // to release mlfq.lock and then reacquire it
-    // before jumping back to us.
-    proc_cnt++;
-    c->proc = p;
-    switchuvm(p);
-    p->state = RUNNING;
+// every queued process is RUNNABLE: processes leave their
+// queue when they start running, sleep or exit.
 
-    swtch(&(c->scheduler), p->context);
-    switchkvm();
+//scheduling in L0 queue, return executed processes count
+int
+L0_scheduling(struct MLFQ* q) {
+  struct proc *p;
+  int proc_cnt = 0;
 
-    // Process is done running for now.
-    // It should have changed its p->state before coming back.
-    c->proc = 0;
+  while((p = L0_pop(q)) != 0) {
+    proc_cnt++;
+    runproc(p);
   }
 
   return proc_cnt;
@@ -168,35 +291,13 @@ L0_scheduling(void) {
 
 //scheduling in L1 queue, return executed processes count
 int
-L1_scheduling(void) {
+L1_scheduling(struct MLFQ* q) {
   struct proc *p;
-  struct cpu *c = mycpu();
-  int proc_cnt = 0, index = 0;
-  c->proc = 0;
-
-  while(mlfq.L1_start != mlfq.L1_end){
-    index = mlfq.L1_start;
-    p = L1_pop();
+  int proc_cnt = 0;
 
-    if(p->state != RUNNABLE) {
-      mlfq.L1_proc[index] = 0;
-      continue;
-    }
-    // Switch to chosen process.  It is the process's job
-    // to release mlfq.lock and then reacquire it
-    // before jumping back to us.
+  while((p = L1_pop(q)) != 0) {
     proc_cnt++;
-
-    c->proc = p;
-    switchuvm(p);
-    p->state = RUNNING;
-
-    swtch(&(c->scheduler), p->context);
-    switchkvm();
-
-    // Process is done running for now.
-    // It should have changed its p->state before coming back.
-    c->proc = 0;
+    runproc(p);
   }
 
   return proc_cnt;
@@ -204,72 +305,491 @@ L1_scheduling(void) {
 
 //scheduling in L2 queue, return executed processes count
 int 
-L2_scheduling(void) {
+L2_scheduling(struct MLFQ* q) {
   struct proc *p;
-  struct cpu *c = mycpu();
-  int proc_cnt = 0, index = 0;
-  c->proc = 0;
-
-  while(mlfq.L2_size > 0) {
-    index = mlfq.L2_size;
-    p = L2_pop();
-
-    if(p->state != RUNNABLE) {
-      mlfq.L2_proc[index] = 0;
-      continue;
-    }
+  int proc_cnt = 0;
 
+  while((p = L2_pop(q)) != 0) {
     // cprintf("pid: %d priority: %d state: %d time_quantum: %d\n",p->pid,p->priority,p->state,p->time_quantum);
-
-    // Switch to chosen process.  It is the process's job
-    // to release mlfq.lock and then reacquire it
-    // before jumping back to us.
     proc_cnt++;
+    runproc(p);
+  }
 
-    c->proc = p;
-    switchuvm(p);
-    p->state = RUNNING;
+  return proc_cnt;
+}
 
-    swtch(&(c->scheduler), p->context);
-    switchkvm();
+// put process on its ready queue at the level its status gives,
+// return that queue. caller holds p->lock.
+static struct MLFQ*
+ready(struct proc* p) {
+  struct MLFQ* q;
+  uint queue_level;
+
+  q = procqueue(p);
+  p->woken = (p->state == SLEEPING);
+  setstate(p, RUNNABLE);
+  boostproc(p, boostepoch(p->cpu));
+  queue_level = p->mlfq_level;
+  if(p->time_quantum >= mlfqconf.quantum[queue_level]) {
+    if(queue_level < 2) {
+      queue_level = nextlevel(queue_level);
+      p->ndemote++;
+      mycpu()->mlfq->ndemote++;
+    } else if(mlfqconf.policy == L2PRIORITY && p->priority) {
+      p->priority--;
+    }
+    p->time_quantum = p->qcycles = 0;
+    // read without tickslock: a word-sized load can't tear, and
+    // time_enter is only a record, nothing orders by it
+    if(queue_level == 2)
+      p->time_enter = ticks;
 
-    // Process is done running for now.
-    // It should have changed its p->state before coming back.
-    c->proc = 0;
+    p->mlfq_level = queue_level;
   }
-
-  return proc_cnt;
+  mlfq_push(q, p);
+  return q;
 }
 
 // enqueue to ready queue
 // determine where to go by looking process's status
 void 
 enqueue(struct proc* p) {
-  uint queue_level = p->mlfq_level;
-  if(p->time_quantum == 2*queue_level+4) {
-    queue_level++;
-    p->time_quantum = 0;
-    if(queue_level >= 2) {
-      acquire(&tickslock);
-      p->time_enter = ticks;
-      release(&tickslock);
+  struct MLFQ* q = ready(p);
+
+  // a yielding process requeued on its own cpu is about to sched();
+  // that cpu picks from q next, so there is nothing to kick or preempt.
+  if(p == myproc() && q == mycpu()->mlfq)
+    return;
+  if(!mlfq_kick(q))
+    mlfq_preempt(q, p);
+}
 
-      if(queue_level > 2) {
-        if(p->priority) p->priority--;
-        queue_level--;
-      }
-    }
+// make woken p RUNNABLE on this cpu and have it run at the next
+// switch here, ahead of the MLFQ order: the waker is about to
+// block or be preempted, and p finds its data still in cache.
+// no sibling is kicked to steal it.
+void
+handoff(struct proc* p) {
+  struct cpu* c = mycpu();
 
-    p->mlfq_level = queue_level;
+  if(c->reserved || p->lock_flag) {
+    enqueue(p);
+    return;
   }
-  if(queue_level == 0) {
-    L0_push(p);
-  } else if (queue_level == 1) {
-    L1_push(p);
+  p->cpu = c - cpus;
+  ready(p);
+  c->handoff = p;
+}
+
+// take the process handed this cpu off its queue, or return 0.
+// the hint only holds for the next switch after handoff(), and
+// only while p still waits on one of this cpu's lists.
+struct proc*
+takehandoff(struct cpu* c) {
+  struct MLFQ* q = c->mlfq;
+  struct proc* p = c->handoff;
+  char* rq;
+
+  c->handoff = 0;
+  if(p == 0)
+    return 0;
+  acquire(&q->lock);
+  rq = (char*)p->rq;
+  if(rq < (char*)q || rq >= (char*)(q + 1)) {
+    release(&q->lock);
+    return 0;
+  }
+  procq_remove(p);
+  q->nready--;
+  release(&q->lock);
+  p->nhandoff++;
+  q->nhandoff++;
+  return p;
+}
+
+// wake cpu c if it is halted in its scheduler
+void
+kickcpu(struct cpu* c) {
+  if(c != mycpu() && xchg(&c->idle, 0))
+    lapicipi(c->apicid, T_IRQ0 + IRQ_RESCHED);
+}
+
+// something was queued on q: wake its cpu if halted,
+// or a halted sibling that can steal it if q's cpu is busy.
+// return 0 if every cpu that could run it is busy.
+int
+mlfq_kick(struct MLFQ* q) {
+  struct cpu* c = &cpus[q - mlfqs];
+  int i;
+
+  // pairs with the barrier in idle(): either the halting cpu
+  // sees the new nready, or we see its idle flag.
+  __sync_synchronize();
+  if(c->idle || c->proc == 0) {
+    kickcpu(c);
+    return 1;
+  }
+  for(i = 0; i < ncpu; i++) {
+    if(cpus[i].idle && cpus[i].reserved == 0 && &cpus[i] != mycpu()) {
+      kickcpu(&cpus[i]);
+      return 1;
+    }
+  }
+  return 0;
+}
+
+// p was queued on q while q's cpu is busy. if that cpu runs
+// something at a lower level, have it reschedule now rather than
+// at the end of its quantum: at the next trap return here, by IPI
+// elsewhere. a reserved cpu is never preempted.
+void
+mlfq_preempt(struct MLFQ* q, struct proc* p) {
+  struct cpu* c = &cpus[q - mlfqs];
+  struct proc* cur = c->proc;
+
+  if(cur == 0 || cur == p || cur->lock_flag ||
+     cur->mlfq_level <= p->mlfq_level)
+    return;
+  c->resched = 1;
+  if(c != mycpu())
+    lapicipi(c->apicid, T_IRQ0 + IRQ_RESCHED);
+}
+
+// return 1, taking the request, if a wakeup asked the process
+// running on this cpu to make way for a higher level one
+int
+resched(void) {
+  struct cpu* c;
+  int r;
+
+  pushcli();
+  c = mycpu();
+  r = c->resched && c->proc && c->proc->lock_flag == 0;
+  c->resched = 0;
+  popcli();
+  return r;
+}
+
+// push process to the list of its current level
+void
+mlfq_push(struct MLFQ* q, struct proc* p) {
+  if(p->mlfq_level == 0) {
+    L0_push(q, p);
+  } else if (p->mlfq_level == 1) {
+    L1_push(q, p);
   } else {
-    L2_push(p);
+    L2_push(q, p);
+  }
+}
+
+// level a process starts at and is boosted to:
+// with a single level everything lives in the L2 lists
+uint
+toplevel(void) {
+  return mlfqconf.nlevel > 1 ? 0 : 2;
+}
+
+// level a process is demoted to from level l.
+// L2 is always the bottom level, L1 is skipped with two levels.
+uint
+nextlevel(uint l) {
+  return l + 2 >= mlfqconf.nlevel ? 2 : l + 1;
+}
+
+// boost generation of a cpu. it advances every boostticks ticks;
+// with stagger each cpu is offset by its share of the
+// interval so cpus don't all boost on the same tick.
+uint
+boostepoch(int cpu) {
+  struct mlfqconf* cf = &mlfqconf;
+  uint seq, t, epoch;
+
+  do {
+    seq = cf->seq;
+    __sync_synchronize();
+    t = ticks - cf->tickbase;
+    epoch = cf->epochbase;
+    if(cf->boostticks) {
+      if(cf->stagger)
+        t += cpu * cf->boostticks / ncpu;
+      epoch += t / cf->boostticks;
+    }
+    __sync_synchronize();
+  } while((seq & 1) || seq != cf->seq);
+  return epoch;
+}
+
+// install new tunables. the boost generation keeps counting up
+// from one past the newest any cpu has seen, so every process
+// is boosted once and restarts at the top of the new levels.
+// return -1 if sc is invalid.
+int
+mlfq_setconf(struct schedconf* sc) {
+  struct mlfqconf* cf = &mlfqconf;
+  uint epoch, e;
+  int i;
+
+  if(sc->nlevel < 1 || sc->nlevel > NCONFLEVEL)
+    return -1;
+  for(i = 0; i < NCONFLEVEL; i++)
+    if(sc->quantum[i] < 1 || sc->quantum[i] > 1000)
+      return -1;
+  if(sc->policy != L2PRIORITY && sc->policy != L2ROUNDROBIN)
+    return -1;
+  if(sc->stagger > 1 || sc->direct > 1)
+    return -1;
+
+  acquire(&conflock);
+  epoch = boostepoch(0);
+  for(i = 1; i < ncpu; i++) {
+    e = boostepoch(i);
+    if((int)(e - epoch) > 0)
+      epoch = e;
+  }
+
+  cf->seq++;
+  __sync_synchronize();
+  cf->nlevel = sc->nlevel;
+  for(i = 0; i < NCONFLEVEL; i++)
+    cf->quantum[i] = sc->quantum[i];
+  cf->policy = sc->policy;
+  cf->boostticks = sc->boostticks;
+  cf->stagger = sc->stagger;
+  cf->direct = sc->direct;
+  cf->epochbase = epoch + 1;
+  cf->tickbase = ticks;
+  __sync_synchronize();
+  cf->seq++;
+  release(&conflock);
+  return 0;
+}
+
+// copy the current tunables out to sc
+void
+mlfq_getconf(struct schedconf* sc) {
+  int i;
+
+  acquire(&conflock);
+  sc->nlevel = mlfqconf.nlevel;
+  for(i = 0; i < NCONFLEVEL; i++)
+    sc->quantum[i] = mlfqconf.quantum[i];
+  sc->policy = mlfqconf.policy;
+  sc->boostticks = mlfqconf.boostticks;
+  sc->stagger = mlfqconf.stagger;
+  sc->direct = mlfqconf.direct;
+  release(&conflock);
+}
+
+// lazy priority boosting: a process that has not been looked at
+// since epoch began is reset to L0 the first time it is examined.
+// return 1 if the process was boosted.
+// a process holding a cpu reservation is left alone; it
+// starts over at the top level when the reservation ends.
+int
+boostproc(struct proc* p, uint epoch) {
+  if(p->lock_flag || (int)(epoch - p->epoch) <= 0)
+    return 0;
+  p->epoch = epoch;
+  p->priority = 3;
+  p->mlfq_level = toplevel();
+  p->time_quantum = p->qcycles = 0;
+  p->time_enter = 0;
+  p->nboost++;
+  mycpu()->mlfq->nboosted++;
+  return 1;
+}
+
+// charge the time p ran since it was last charged to its
+// quantum: whole ticks go to time_quantum, the rest is carried
+// in qcycles. a process that keeps giving up the cpu just before
+// the timer fires still uses up its quantum this way.
+// called on the cpu running p, on each tick and when it stops.
+void
+charge(struct proc* p) {
+  uint64 now = rdtsc();
+  uint64 cycles = now - p->qstamp + p->qcycles;
+  uint tc = tickcycles;
+
+  p->qstamp = now;
+  if(tc == 0) {
+    // not calibrated yet: count timer ticks only
+    p->qcycles = 0;
+    return;
+  }
+  while(cycles >= tc) {
+    cycles -= tc;
+    p->time_quantum++;
+  }
+  p->qcycles = cycles;
+}
+
+// end a schedulerLock period, charging its length to p
+void
+endlock(struct proc* p) {
+  if(p->lock_flag == 0) return;
+  p->lock_flag = 0;
+  p->tlocked += rdtsc() - p->lockstamp;
+}
+
+// dedicate the cpu p runs on to p: what is queued there moves to
+// the other cpus, which stop placing or stealing work on it.
+// return 0, reserving nothing, if no other cpu would be left.
+// caller holds p->lock; the processes moved are locked in turn,
+// which is safe as nothing else can reach them once popped.
+int
+reserve(struct proc* p) {
+  struct cpu* c = &cpus[p->cpu];
+  struct MLFQ *q = c->mlfq, *nq;
+  struct proc* np;
+  int i, n = 0;
+
+  for(i = 0; i < ncpu; i++)
+    if(&cpus[i] != c && cpus[i].reserved == 0)
+      n++;
+  if(n == 0)
+    return 0;
+
+  c->reserved = p;
+  while((np = L0_pop(q)) != 0 ||
+        (np = L1_pop(q)) != 0 ||
+        (np = L2_pop(q)) != 0) {
+    acquire(&np->lock);
+    nq = procqueue(np);
+    boostproc(np, nq->epoch);
+    mlfq_push(nq, np);
+    release(&np->lock);
+    mlfq_kick(nq);
   }
+  return 1;
+}
+
+// give back the cpu reserved for p, if any, and end p's lock.
+// caller holds p->lock.
+void
+unreserve(struct proc* p) {
+  int i;
 
+  for(i = 0; i < ncpu; i++)
+    if(cpus[i].reserved == p)
+      cpus[i].reserved = 0;
+  endlock(p);
+}
+
+// count a wakeup-to-run latency in q's histogram of level
+void
+latency(struct MLFQ* q, uint level, uint64 cycles) {
+  int i = 0;
+
+  cycles >>= LATSHIFT + 1;
+  while(cycles && i < NLATBUCKET-1) {
+    cycles >>= 1;
+    i++;
+  }
+  if(level >= NSTATLEVEL)
+    level = NSTATLEVEL-1;
+  q->lat[level][i]++;
+}
+
+// start a new boost generation on q: L1 and L2 move behind L0
+// in the order they would have run. their processes are reset
+// by boostproc() when they are picked, not here.
+void
+mlfq_boost(struct MLFQ* q, uint epoch) {
+  uint64 start = rdtsc();
+  uint pause;
+  int i;
+
+  acquire(&q->lock);
+  if(q->epoch == epoch) {
+    release(&q->lock);
+    return;
+  }
+  q->epoch = epoch;
+  procq_splice(&q->L0, &q->L1);
+  for(i = 0; i < L2PRIO; i++)
+    procq_splice(&q->L0, &q->L2[i]);
+  release(&q->lock);
+
+  pause = rdtsc() - start;
+  q->nboost++;
+  q->boostlast = pause;
+  if(pause > q->boostmax)
+    q->boostmax = pause;
+}
+
+// number of processes a cpu is already responsible for
+static uint
+cpuload(struct cpu* c) {
+  return c->mlfq->nready + (c->proc != 0);
+}
+
+// ready queue of the cpu a process last ran on.
+// a process that never ran, or last ran on a cpu since reserved
+// for another, goes to the least loaded unreserved cpu.
+struct MLFQ*
+procqueue(struct proc* p) {
+  int i;
+
+  if(p->cpu < 0 || p->cpu >= ncpu ||
+     (cpus[p->cpu].reserved && cpus[p->cpu].reserved != p)) {
+    p->cpu = -1;
+    for(i = 0; i < ncpu; i++) {
+      if(cpus[i].reserved)
+        continue;
+      if(p->cpu < 0 || cpuload(&cpus[i]) < cpuload(&cpus[p->cpu]))
+        p->cpu = i;
+    }
+  }
+  return cpus[p->cpu].mlfq;
+}
+
+// check without the queue locks whether q or any sibling
+// has something queued, so idle cpus don't take them for nothing.
+// a reserved cpu only runs what is on its own queue.
+int
+mlfq_haswork(struct MLFQ* q) {
+  int i;
+
+  if(q->nready)
+    return 1;
+  if(cpus[q - mlfqs].reserved)
+    return 0;
+  for(i = 0; i < ncpu; i++)
+    if(cpus[i].mlfq->nready)
+      return 1;
+  return 0;
+}
+
+// move one runnable process from the busiest sibling into q,
+// taking it from the highest level the sibling has.
+// return 1 if a process was stolen.
+int
+mlfq_steal(struct MLFQ* q) {
+  struct MLFQ* victim = 0;
+  struct proc* p;
+  int i;
+
+  if(cpus[q - mlfqs].reserved)
+    return 0;
+  for(i = 0; i < ncpu; i++) {
+    if(cpus[i].mlfq == q || cpus[i].mlfq->nready == 0 || cpus[i].reserved)
+      continue;
+    if(victim == 0 || cpus[i].mlfq->nready > victim->nready)
+      victim = cpus[i].mlfq;
+  }
+  if(victim == 0)
+    return 0;
+
+  if((p = L0_pop(victim)) != 0 ||
+     (p = L1_pop(victim)) != 0 ||
+     (p = L2_pop(victim)) != 0) {
+    acquire(&p->lock);
+    boostproc(p, q->epoch);
+    mlfq_push(q, p);
+    release(&p->lock);
+    return 1;
+  }
+  return 0;
 }
 
 // just return process's ready queue level
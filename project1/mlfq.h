@@ -1,8 +1,42 @@
+// Per-cpu ready queues. Each cpu owns one MLFQ (cpu->mlfq),
+// its lists protected by its own lock.
+// Queues are intrusive lists through struct proc, so they hold
+// only RUNNABLE processes and never more than NPROC of them.
 struct MLFQ {
-  struct proc* L0_proc[LNPROC];
-	struct proc* L1_proc[LNPROC];
-	struct proc* L2_proc[LNPROC];
-	uint L0_start, L0_end;
-	uint L1_start, L1_end;
-	uint L2_size;
-};
\ No newline at end of file
+  struct spinlock lock;          // lists and nready
+  struct procq L0;
+  struct procq L1;
+  struct procq L2[L2PRIO];       // one FIFO per priority
+  volatile uint nready;          // queued processes, peeked without lock
+  uint epoch;                    // boost generation applied to the lists
+  uint nboost;                   // boosts done on this cpu
+  uint boostlast, boostmax;      // boost pause in tsc cycles
+
+  // scheduler statistics of this cpu, summed by schedstat()
+  uint nswitch;                  // processes switched to
+  uint ndemote;                  // level demotions
+  uint nboosted;                 // processes boosted back to L0
+  uint nlock;                    // schedulerLock periods started
+  uint nhandoff;                 // switches to a process handed the cpu
+  uint lat[NSTATLEVEL][NLATBUCKET]; // wakeup-to-run latency histogram
+};
+
+extern struct MLFQ mlfqs[NCPU];
+
+// Scheduler tunables, read on every tick and enqueue and kept
+// together on one cache line. Changed by mlfq_setconf() under
+// a lock of its own; seq is odd while a change is in progress so
+// boostepoch() can read the boost fields without the lock.
+struct mlfqconf {
+  volatile uint seq;
+  uint nlevel;                   // levels in use, see schedconf.h
+  uint quantum[NCONFLEVEL];      // ticks at each level before demotion
+  uint policy;                   // L2PRIORITY or L2ROUNDROBIN
+  uint boostticks;               // ticks between boosts, 0 never
+  uint stagger;                  // spread per-cpu boosts
+  uint direct;                   // process to process switches
+  uint epochbase;                // boost generation at tickbase
+  uint tickbase;                 // ticks when boostticks was set
+} __attribute__((aligned(64)));
+
+extern struct mlfqconf mlfqconf;
\ No newline at end of file
@@ -0,0 +1,419 @@
+// MLFQ scheduler benchmarks.
+// Results are printed as "key=value" lines so that runs with
+// different kernels or CPUS= settings can be compared by script.
+//
+//   mlfqbench scale [workers] [loops]
+//     fork workers CPU hogs that each spin for loops iterations
+//     and report the ticks until all of them finished.
+//     Run under CPUS=1..8 to see how the scheduler scales.
+//
+//   mlfqbench mix [hogs] [sleepers] [writers] [prio] [ticks] [seed]
+//     run a mixed workload for ticks clock ticks:
+//       hog      spins, counting work done at each MLFQ level
+//       sleeper  sleeps 1-3 ticks, then runs a short burst
+//       writer   writes 512-byte blocks to a file, like stressfs
+//       prio     spins after setPriority(self, i % 4)
+//     Burst and sleep lengths come from seed, so a run is
+//     reproducible. Each worker prints one "worker" line, then a
+//     "summary" line gives the context switch rate, per-level
+//     throughput, wakeup latency percentiles and starvation.
+//
+//   mlfqbench fork [forkers] [hogs] [ticks]
+//     for ticks clock ticks, forkers fork and reap short-lived
+//     children one at a time while hogs spin. Reports forks and
+//     hog work per tick; run under CPUS=1..8 to see how process
+//     creation and exit scale next to CPU-bound work.
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "fcntl.h"
+#include "schedstat.h"
+
+#define DEF_WORKERS 8
+#define DEF_LOOPS   20000000
+
+#define NKIND   4
+#define HOG     0
+#define SLEEPER 1
+#define WRITER  2
+#define PRIO    3
+#define FORKER  NKIND   // fork mode only
+
+#define BURST   1000    // spin iterations per unit of work
+
+char *kindname[NKIND] = { "hog", "sleeper", "writer", "prio" };
+
+#define MAXWORKERS 64
+
+// What each worker leaves behind for the parent, in a file
+// named by resname(): a pipe could interleave records.
+struct result {
+  int kind;
+  int id;
+  int pid;
+  uint work;                 // units of work done
+  uint level[NSTATLEVEL];    // units done at each MLFQ level
+  uint run;                  // Mcycles spent RUNNING
+  uint wait;                 // Mcycles spent RUNNABLE
+  uint nswitch;
+};
+
+volatile uint sink;
+uint seed;
+
+void
+spin(int loops)
+{
+  int i;
+
+  for(i = 0; i < loops; i++)
+    sink += i;
+}
+
+uint
+rand(void)
+{
+  seed = seed * 1103515245 + 12345;
+  return (seed >> 16) & 0x7fff;
+}
+
+// "mbres" followed by two digits of n
+void
+resname(char *buf, int n)
+{
+  strcpy(buf, "mbres00");
+  buf[5] += n / 10 % 10;
+  buf[6] += n % 10;
+}
+
+// leave r in result file n for the parent
+void
+putresult(int n, struct result *r)
+{
+  char path[8];
+  int fd;
+
+  resname(path, n);
+  if((fd = open(path, O_CREATE | O_WRONLY)) >= 0){
+    write(fd, r, sizeof(*r));
+    close(fd);
+  }
+}
+
+// read and remove result file n, return -1 if missing
+int
+getresult(int n, struct result *r)
+{
+  char path[8];
+  int fd, cc;
+
+  resname(path, n);
+  if((fd = open(path, O_RDONLY)) < 0)
+    return -1;
+  cc = read(fd, r, sizeof(*r));
+  close(fd);
+  unlink(path);
+  return cc == sizeof(*r) ? 0 : -1;
+}
+
+void
+scale(int workers, int loops)
+{
+  int i, start, end;
+
+  start = uptime();
+  for(i = 0; i < workers; i++){
+    int pid = fork();
+    if(pid < 0){
+      printf(2, "mlfqbench: fork failed\n");
+      break;
+    }
+    if(pid == 0){
+      spin(loops);
+      exit();
+    }
+  }
+  while(wait() != -1)
+    ;
+  end = uptime();
+
+  printf(1, "bench=scale workers=%d loops=%d ticks=%d\n",
+         workers, loops, end - start);
+}
+
+// count one unit of work at the current level
+void
+done(struct result *r)
+{
+  int l = getLevel();
+
+  r->work++;
+  if(l >= 0 && l < NSTATLEVEL)
+    r->level[l]++;
+}
+
+void
+worker(int kind, int id, int n, int deadline)
+{
+  struct result r;
+  struct schedstat st;
+  char path[] = "mlfqbench00";
+  char data[512];
+  int f = -1;
+
+  memset(&r, 0, sizeof(r));
+  r.kind = kind;
+  r.id = id;
+  r.pid = getpid();
+  seed += id * 7919 + kind;
+
+  if(kind == PRIO)
+    setPriority(r.pid, id % 4);
+  if(kind == WRITER){
+    path[9] += id / 10 % 10;
+    path[10] += id % 10;
+    memset(data, 'a' + id % 26, sizeof(data));
+    f = open(path, O_CREATE | O_RDWR);
+  }
+
+  while(uptime() < deadline){
+    switch(kind){
+    case SLEEPER:
+      sleep(1 + rand() % 3);
+      spin(BURST * (1 + rand() % 8));
+      break;
+    case WRITER:
+      if(f < 0 || write(f, data, sizeof(data)) != sizeof(data)){
+        printf(2, "mlfqbench: write %s failed\n", path);
+        deadline = 0;
+        continue;
+      }
+      // keep the file small: start over every 64 blocks
+      if((r.work + 1) % 64 == 0){
+        close(f);
+        f = open(path, O_CREATE | O_RDWR);
+      }
+      break;
+    default:
+      spin(BURST);
+      break;
+    }
+    done(&r);
+  }
+
+  if(f >= 0){
+    close(f);
+    unlink(path);
+  }
+  if(schedstat(r.pid, &st) == 0){
+    r.run = st.proc.running >> 20;
+    r.wait = st.proc.runnable >> 20;
+    r.nswitch = st.proc.nswitch;
+  }
+  putresult(n, &r);
+  exit();
+}
+
+// fork and reap one child at a time until deadline
+void
+forker(int id, int n, int deadline)
+{
+  struct result r;
+  int pid;
+
+  memset(&r, 0, sizeof(r));
+  r.kind = FORKER;
+  r.id = id;
+  r.pid = getpid();
+  while(uptime() < deadline){
+    if((pid = fork()) < 0)
+      break;
+    if(pid == 0)
+      exit();
+    wait();
+    r.work++;
+  }
+  putresult(n, &r);
+  exit();
+}
+
+// upper bound, in kcycles, of the latency bucket holding
+// the pct'th percentile of hist, or 0 if hist is empty
+uint
+percentile(uint *hist, int pct)
+{
+  uint total = 0, sum = 0;
+  int i;
+
+  for(i = 0; i < NLATBUCKET; i++)
+    total += hist[i];
+  if(total == 0)
+    return 0;
+  for(i = 0; i < NLATBUCKET; i++){
+    sum += hist[i];
+    if(sum * 100 >= total * pct)
+      break;
+  }
+  if(i == NLATBUCKET)
+    i--;
+  return 1 << (i + LATSHIFT + 1 - 10);
+}
+
+void
+mix(int n[NKIND], int ticks)
+{
+  static struct schedstat before, after;
+  struct result r;
+  uint level[NSTATLEVEL], hist[NLATBUCKET];
+  uint minwork = 0xffffffff, maxwork = 0, sumwork = 0;
+  int kind, i, l, nworkers = 0, nhogs = 0, starved = 0;
+  int start, end, deadline;
+  uint hogwork[MAXWORKERS];
+
+  schedstat(0, &before);
+  start = uptime();
+  deadline = start + ticks;
+
+  for(kind = 0; kind < NKIND; kind++){
+    for(i = 0; i < n[kind] && nworkers < MAXWORKERS; i++){
+      int pid = fork();
+      if(pid < 0){
+        printf(2, "mlfqbench: fork failed\n");
+        break;
+      }
+      if(pid == 0)
+        worker(kind, i, nworkers, deadline);
+      nworkers++;
+    }
+  }
+  while(wait() != -1)
+    ;
+  end = uptime();
+  schedstat(0, &after);
+
+  memset(level, 0, sizeof(level));
+  for(i = 0; i < nworkers; i++){
+    if(getresult(i, &r) < 0)
+      continue;
+    printf(1, "worker kind=%s id=%d pid=%d work=%d l0=%d l1=%d l2=%d "
+           "run_mc=%d wait_mc=%d switches=%d\n",
+           kindname[r.kind], r.id, r.pid, r.work,
+           r.level[0], r.level[1], r.level[2],
+           r.run, r.wait, r.nswitch);
+    for(l = 0; l < NSTATLEVEL; l++)
+      level[l] += r.level[l];
+    if(r.kind == HOG || r.kind == PRIO){
+      if(r.work < minwork) minwork = r.work;
+      if(r.work > maxwork) maxwork = r.work;
+      sumwork += r.work;
+      hogwork[nhogs++] = r.work;
+    }
+  }
+
+  // a spinning worker that got less than a tenth of the
+  // average spinning share counts as starved
+  for(i = 0; i < nhogs; i++)
+    if(hogwork[i] * 10 * nhogs < sumwork)
+      starved++;
+  if(nhogs == 0)
+    minwork = 0;
+
+  if(end == start)
+    end++;
+  printf(1, "summary workers=%d ticks=%d switches=%d switches_per_100ticks=%d "
+         "demotions=%d boosts=%d handoffs=%d",
+         nworkers, end - start, after.nswitch - before.nswitch,
+         (after.nswitch - before.nswitch) * 100 / (end - start),
+         after.ndemote - before.ndemote, after.nboost - before.nboost,
+         after.nhandoff - before.nhandoff);
+  for(l = 0; l < NSTATLEVEL; l++)
+    printf(1, " l%d_work_per_tick=%d", l, level[l] / (end - start));
+  for(l = 0; l < NSTATLEVEL; l++){
+    for(i = 0; i < NLATBUCKET; i++)
+      hist[i] = after.lat[l][i] - before.lat[l][i];
+    printf(1, " l%d_lat_p50_kc=%d l%d_lat_p99_kc=%d",
+           l, percentile(hist, 50), l, percentile(hist, 99));
+  }
+  printf(1, " spin_min=%d spin_max=%d starved=%d\n",
+         minwork, maxwork, starved);
+}
+
+void
+forkstorm(int forkers, int hogs, int ticks)
+{
+  struct result r;
+  uint forks = 0, work = 0;
+  int i, n = 0, start, end, deadline;
+
+  start = uptime();
+  deadline = start + ticks;
+  for(i = 0; i < hogs + forkers && n < MAXWORKERS; i++){
+    int pid = fork();
+    if(pid < 0){
+      printf(2, "mlfqbench: fork failed\n");
+      break;
+    }
+    if(pid == 0){
+      if(i < hogs)
+        worker(HOG, i, n, deadline);
+      forker(i - hogs, n, deadline);
+    }
+    n++;
+  }
+  while(wait() != -1)
+    ;
+  end = uptime();
+
+  for(i = 0; i < n; i++){
+    if(getresult(i, &r) < 0)
+      continue;
+    if(r.kind == FORKER)
+      forks += r.work;
+    else
+      work += r.work;
+  }
+  if(end == start)
+    end++;
+  printf(1, "bench=fork forkers=%d hogs=%d ticks=%d forks=%d "
+         "forks_per_100ticks=%d hog_work_per_tick=%d\n",
+         forkers, hogs, end - start, forks,
+         forks * 100 / (end - start), work / (end - start));
+}
+
+void
+usage(void)
+{
+  printf(2, "usage: mlfqbench scale [workers] [loops]\n");
+  printf(2, "       mlfqbench mix [hogs] [sleepers] [writers] [prio]"
+            " [ticks] [seed]\n");
+  printf(2, "       mlfqbench fork [forkers] [hogs] [ticks]\n");
+  exit();
+}
+
+int
+main(int argc, char *argv[])
+{
+  int n[NKIND] = { 2, 2, 1, 2 };
+  int i;
+
+  if(argc < 2)
+    usage();
+
+  if(strcmp(argv[1], "scale") == 0){
+    scale(argc > 2 ? atoi(argv[2]) : DEF_WORKERS,
+          argc > 3 ? atoi(argv[3]) : DEF_LOOPS);
+  } else if(strcmp(argv[1], "mix") == 0){
+    for(i = 0; i < NKIND && i + 2 < argc; i++)
+      n[i] = atoi(argv[i + 2]);
+    seed = argc > 7 ? atoi(argv[7]) : 1;
+    mix(n, argc > 6 ? atoi(argv[6]) : 500);
+  } else if(strcmp(argv[1], "fork") == 0){
+    forkstorm(argc > 2 ? atoi(argv[2]) : 4,
+              argc > 3 ? atoi(argv[3]) : 4,
+              argc > 4 ? atoi(argv[4]) : 500);
+  } else {
+    usage();
+  }
+  exit();
+}
@@ -1,8 +1,13 @@
 #define NPROC        64  // maximum number of processes
-#define LNPROC      128  // maximum number of processes queue
-#define L0TIMEMAX     4  // maximum L0 scheduler time quantum
-#define L1TIMEMAX     6  // maximum L1 scheduler time quantum
-#define L2TIMEMAX     8  // maximum L2 scheduler time quantum
+#define NSLEEPQ      64  // sleep queues, hashed by channel
+#define NPIDHASH     64  // pid index buckets
+#define L0TIMEMAX     4  // default L0 time quantum, see schedconf.h
+#define L1TIMEMAX     6  // default L1 time quantum
+#define L2TIMEMAX     8  // default L2 time quantum
+#define L2PRIO        4  // number of L2 priorities (0 runs first)
+#define BOOSTTICKS  100  // default ticks between priority boosts
+#define BOOSTSTAGGER  0  // 1: spread per-cpu boosts over BOOSTTICKS
+#define RESERVETICKS 100 // longest schedulerLock cpu reservation
 #define KSTACKSIZE 4096  // size of per-process kernel stack
 #define NCPU          8  // maximum number of CPUs
 #define NOFILE       16  // open files per process
@@ -0,0 +1,101 @@
+// Pipe ping-pong: two processes pass one byte back and forth,
+// so every round trip is two wakeups and two context switches.
+//
+//   pingpong [rounds]
+//
+// Runs once with the scheduler loop between processes (direct=0)
+// and once switching process to process (direct=1), and prints
+// a "key=value" line for each. handoffs counts the switches that
+// went straight to the woken pipe peer; only a writer that fills
+// the pipe hands off, so one-byte rounds should show none.
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "schedstat.h"
+#include "schedconf.h"
+
+#define DEF_ROUNDS 10000
+
+static inline uint64
+rdtsc(void)
+{
+  uint lo, hi;
+
+  asm volatile("rdtsc" : "=a" (lo), "=d" (hi));
+  return ((uint64)hi << 32) | lo;
+}
+
+void
+run(int rounds, int direct)
+{
+  static struct schedstat before, after;
+  struct schedconf sc;
+  int ping[2], pong[2], i, pid, start, end;
+  uint64 t0, t1;
+  char c = 0;
+
+  schedconf(0, &sc);
+  sc.direct = direct;
+  if(schedconf(&sc, 0) < 0){
+    printf(2, "pingpong: schedconf failed\n");
+    return;
+  }
+  if(pipe(ping) < 0 || pipe(pong) < 0){
+    printf(2, "pingpong: pipe failed\n");
+    exit();
+  }
+
+  pid = fork();
+  if(pid < 0){
+    printf(2, "pingpong: fork failed\n");
+    exit();
+  }
+  if(pid == 0){
+    close(ping[1]);
+    close(pong[0]);
+    for(i = 0; i < rounds; i++){
+      if(read(ping[0], &c, 1) != 1)
+        break;
+      write(pong[1], &c, 1);
+    }
+    exit();
+  }
+
+  close(ping[0]);
+  close(pong[1]);
+  schedstat(0, &before);
+  start = uptime();
+  t0 = rdtsc();
+  for(i = 0; i < rounds; i++){
+    write(ping[1], &c, 1);
+    if(read(pong[0], &c, 1) != 1)
+      break;
+  }
+  t1 = rdtsc();
+  end = uptime();
+  close(ping[1]);
+  close(pong[0]);
+  wait();
+  schedstat(0, &after);
+
+  // no 64-bit division in user space: scale down first
+  printf(1, "bench=pingpong direct=%d rounds=%d ticks=%d cycles_per_round=%d"
+         " handoffs=%d\n",
+         direct, i, end - start,
+         i ? (uint)((t1 - t0) >> 4) / i * 16 : 0,
+         after.nhandoff - before.nhandoff);
+}
+
+int
+main(int argc, char *argv[])
+{
+  struct schedconf sc;
+  int rounds = argc > 1 ? atoi(argv[1]) : DEF_ROUNDS;
+
+  schedconf(0, &sc);
+  run(rounds, 0);
+  run(rounds, 1);
+  schedconf(&sc, 0);
+  exit();
+}
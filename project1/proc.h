@@ -1,4 +1,5 @@
-// Per-CPU state
+// Per-CPU state, one cache line or more each so that cpus
+// don't share lines in cpus[].
 struct cpu {
   uchar apicid;                // Local APIC ID
   struct context *scheduler;   // swtch() here to enter scheduler
@@ -7,8 +8,19 @@ struct cpu {
   volatile uint started;       // Has the CPU started?
   int ncli;                    // Depth of pushcli nesting.
   int intena;                  // Were interrupts enabled before pushcli?
+  // Cpu-local storage: %gs points at self, so self is %gs:0
+  // and proc is %gs:4 (see seginit, mycpu and myproc).
+  struct cpu *self;            // This struct
   struct proc *proc;           // The process running on this cpu or null
-};
+  volatile uint idle;          // Halted in scheduler, waiting for a kick
+  uint nhalt;                  // Times this cpu went idle
+  uint64 idlecycles;           // Tsc cycles spent halted
+  struct MLFQ *mlfq;           // This cpu's ready queues (mlfq.c)
+  struct proc *reserved;       // Process this cpu is dedicated to, or 0
+  volatile uint resched;       // A higher level process is waiting
+  struct proc *handoff;        // Woken process to run next, see handoff()
+  struct proc *prev;           // Process that swtch()ed away, lock still held
+} __attribute__((aligned(64)));
 
 extern struct cpu cpus[NCPU];
 extern int ncpu;
@@ -32,10 +44,17 @@ struct context {
   uint eip;
 };
 
+// Intrusive FIFO of processes, linked through proc->next/prev.
+struct procq {
+  struct proc *head;
+  struct proc *tail;
+};
+
 enum procstate { UNUSED, EMBRYO, SLEEPING, RUNNABLE, RUNNING, ZOMBIE };
 
 // Per-process state
 struct proc {
+  struct spinlock lock;        // Protects state, killed, chan and scheduling
   uint sz;                     // Size of process memory (bytes)
   pde_t* pgdir;                // Page table
   char *kstack;                // Bottom of kernel stack for this process
@@ -45,6 +64,9 @@ struct proc {
   struct trapframe *tf;        // Trap frame for current syscall
   struct context *context;     // swtch() here to run process
   void *chan;                  // If non-zero, sleeping on chan
+  struct proc *snext;          // Next sleeper in chan's sleep queue
+  struct proc *freenext;       // Next UNUSED proc on the free list
+  struct proc *pidnext;        // Next proc in pid's index bucket
   int killed;                  // If non-zero, have been killed
   struct file *ofile[NOFILE];  // Open files
   struct inode *cwd;           // Current directory
@@ -54,6 +76,26 @@ struct proc {
   uint priority;
   uint time_enter;
   uint lock_flag;
+  uint qcycles;                // Tsc cycles run short of a whole tick
+  uint64 qstamp;               // Tsc since which running is uncharged
+  uint epoch;                  // Boost generation mlfq_level belongs to
+  int woken;                   // Made RUNNABLE by a wakeup, not a yield
+  uint64 stamp;                // Tsc of the last state change
+  uint64 trunnable;            // Tsc cycles spent in each state
+  uint64 trunning;
+  uint64 tsleeping;
+  uint64 tlocked;              // Tsc cycles spent under schedulerLock
+  uint64 lockstamp;            // Tsc when schedulerLock was taken
+  uint lockend;                // Ticks at which the reservation ends
+  uint nswitch;                // Times scheduled
+  uint ndemote;                // Moves to a lower level
+  uint nboost;                 // Boosts back to L0
+  uint nlock;                  // schedulerLock periods
+  uint nhandoff;               // Times run by a handoff from a waker
+  int cpu;                     // Cpu whose ready queue holds this process
+  struct procq *rq;            // Ready queue holding this process, or 0
+  struct proc *next;           // Links in rq
+  struct proc *prev;
 };
 
 // Process memory is laid out contiguously, low addresses first:
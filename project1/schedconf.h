@@ -0,0 +1,18 @@
+// MLFQ tunables read and set with the schedconf() system call.
+
+#define NCONFLEVEL   3   // MLFQ levels L0, L1, L2
+
+// L2 policies
+#define L2PRIORITY   0   // one FIFO per priority, priority drops
+                         // each time the L2 quantum runs out
+#define L2ROUNDROBIN 1   // a single FIFO, priorities ignored
+
+struct schedconf {
+  uint nlevel;                  // 3: L0, L1, L2; 2: L0, L2; 1: L2 only
+  uint quantum[NCONFLEVEL];     // Ticks at L0, L1, L2 before demotion
+  uint policy;                  // L2PRIORITY or L2ROUNDROBIN
+  uint boostticks;              // Ticks between boosts, 0 never boosts
+  uint stagger;                 // 1: spread per-cpu boosts over boostticks
+  uint direct;                  // 1: sched() switches straight to the
+                                // next process, 0: via the scheduler loop
+};
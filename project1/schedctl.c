@@ -0,0 +1,87 @@
+// View or change the MLFQ tunables at runtime.
+//
+//   schedctl                       print the current settings
+//   schedctl key=value ...         change some of them
+//
+// Keys: levels (1-3), q0 q1 q2 (ticks at each level),
+// boost (ticks between boosts, 0 never), stagger (0 or 1),
+// policy (prio or rr, how L2 is ordered),
+// direct (0 or 1, process to process context switches).
+// Settings are printed as one "key=value" line.
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "schedconf.h"
+
+void
+print(struct schedconf *sc)
+{
+  printf(1, "levels=%d q0=%d q1=%d q2=%d boost=%d stagger=%d policy=%s"
+         " direct=%d\n",
+         sc->nlevel, sc->quantum[0], sc->quantum[1], sc->quantum[2],
+         sc->boostticks, sc->stagger,
+         sc->policy == L2ROUNDROBIN ? "rr" : "prio", sc->direct);
+}
+
+// apply one key=value argument to sc, return -1 if unknown
+int
+set(struct schedconf *sc, char *arg)
+{
+  char *v;
+
+  if((v = strchr(arg, '=')) == 0)
+    return -1;
+  *v++ = 0;
+
+  if(strcmp(arg, "levels") == 0)
+    sc->nlevel = atoi(v);
+  else if(strcmp(arg, "q0") == 0)
+    sc->quantum[0] = atoi(v);
+  else if(strcmp(arg, "q1") == 0)
+    sc->quantum[1] = atoi(v);
+  else if(strcmp(arg, "q2") == 0)
+    sc->quantum[2] = atoi(v);
+  else if(strcmp(arg, "boost") == 0)
+    sc->boostticks = atoi(v);
+  else if(strcmp(arg, "stagger") == 0)
+    sc->stagger = atoi(v);
+  else if(strcmp(arg, "direct") == 0)
+    sc->direct = atoi(v);
+  else if(strcmp(arg, "policy") == 0 && strcmp(v, "prio") == 0)
+    sc->policy = L2PRIORITY;
+  else if(strcmp(arg, "policy") == 0 && strcmp(v, "rr") == 0)
+    sc->policy = L2ROUNDROBIN;
+  else
+    return -1;
+  return 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+  struct schedconf sc;
+  int i;
+
+  if(schedconf(0, &sc) < 0){
+    printf(2, "schedctl: schedconf failed\n");
+    exit();
+  }
+  if(argc < 2){
+    print(&sc);
+    exit();
+  }
+
+  for(i = 1; i < argc; i++){
+    if(set(&sc, argv[i]) < 0){
+      printf(2, "schedctl: bad setting %s\n", argv[i]);
+      exit();
+    }
+  }
+  if(schedconf(&sc, 0) < 0){
+    printf(2, "schedctl: settings rejected\n");
+    exit();
+  }
+  print(&sc);
+  exit();
+}
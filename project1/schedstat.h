@@ -0,0 +1,38 @@
+// Scheduler statistics returned by the schedstat() system call.
+// Times are in tsc cycles.
+
+#define NSTATLEVEL   3   // MLFQ levels L0, L1, L2
+#define NSTATCPU     8   // cpus reported, at least NCPU
+#define NLATBUCKET  16   // wakeup latency histogram buckets
+#define LATSHIFT    10   // bucket i counts latencies in
+                         // [2^(i+LATSHIFT), 2^(i+LATSHIFT+1)) cycles;
+                         // the first and last buckets are open-ended
+
+// Accounting of one process.
+struct procstat {
+  int pid;
+  uint level;                   // Current MLFQ level
+  uint priority;                // Current L2 priority
+  uint64 runnable;              // Time spent RUNNABLE
+  uint64 running;               // Time spent RUNNING
+  uint64 sleeping;              // Time spent SLEEPING
+  uint64 locked;                // Time spent under schedulerLock
+  uint nswitch;                 // Times scheduled
+  uint ndemote;                 // Moves to a lower level
+  uint nboost;                  // Boosts back to L0
+  uint nlock;                   // schedulerLock periods
+  uint nhandoff;                // Times run by a handoff from a waker
+};
+
+// System-wide counters, summed over the per-cpu counters on read.
+struct schedstat {
+  uint ncpu;
+  uint nswitch;                 // Context switches into processes
+  uint ndemote;                 // Level demotions
+  uint nboost;                  // Processes boosted back to L0
+  uint nlock;                   // schedulerLock periods started
+  uint nhandoff;                // Switches to a woken pipe peer
+  uint lat[NSTATLEVEL][NLATBUCKET]; // Wakeup-to-run latency per level
+  uint64 idle[NSTATCPU];        // Time each cpu spent halted
+  struct procstat proc;         // Filled in if a pid was given
+};
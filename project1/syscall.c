@@ -3,6 +3,7 @@
 #include "param.h"
 #include "memlayout.h"
 #include "mmu.h"
+#include "spinlock.h"
 #include "proc.h"
 #include "x86.h"
 #include "syscall.h"
@@ -109,6 +110,10 @@ extern int sys_getLevel(void);
 extern int sys_setPriority(void);
 extern int sys_schedulerLock(void);
 extern int sys_schedulerUnlock(void);
+extern int sys_schedstat(void);
+extern int sys_schedconf(void);
+extern int sys_reservecpu(void);
+extern int sys_releasecpu(void);
 
 static int (*syscalls[])(void) = {
 [SYS_fork]    sys_fork,
@@ -138,6 +143,10 @@ static int (*syscalls[])(void) = {
 [SYS_setPriority]   sys_setPriority,
 [SYS_schedulerLock] sys_schedulerLock,
 [SYS_schedulerUnlock] sys_schedulerUnlock,
+[SYS_schedstat] sys_schedstat,
+[SYS_schedconf] sys_schedconf,
+[SYS_reservecpu] sys_reservecpu,
+[SYS_releasecpu] sys_releasecpu,
 };
 
 void
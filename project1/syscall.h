@@ -26,3 +26,7 @@
 #define SYS_setPriority 25
 #define SYS_schedulerLock 26
 #define SYS_schedulerUnlock 27
+#define SYS_schedstat 28
+#define SYS_schedconf 29
+#define SYS_reservecpu 30
+#define SYS_releasecpu 31
@@ -5,7 +5,10 @@
 #include "param.h"
 #include "memlayout.h"
 #include "mmu.h"
+#include "spinlock.h"
 #include "proc.h"
+#include "schedstat.h"
+#include "schedconf.h"
 
 int
 sys_fork(void)
@@ -115,8 +118,7 @@ sys_setPriority(void)
   if(argint(0, &pid) < 0)
     return -1;
 
-  setPriority(pid,priority);
-  return 0;
+  return setPriority(pid,priority);
 }
 
 int
@@ -141,4 +143,45 @@ sys_schedulerUnlock(void)
 
   schedulerUnlock(pw);
   return 0;
-}
\ No newline at end of file
+}
+
+int
+sys_reservecpu(void)
+{
+  return reservecpu();
+}
+
+int
+sys_releasecpu(void)
+{
+  return releasecpu();
+}
+
+int
+sys_schedstat(void)
+{
+  int pid;
+  struct schedstat *st;
+
+  if(argint(0, &pid) < 0 || argptr(1, (void*)&st, sizeof(*st)) < 0)
+    return -1;
+
+  return schedstat(pid, st);
+}
+
+// schedconf(set, old): either pointer may be 0
+int
+sys_schedconf(void)
+{
+  int set, old;
+  struct schedconf *sp = 0, *op = 0;
+
+  if(argint(0, &set) < 0 || argint(1, &old) < 0)
+    return -1;
+  if(set && argptr(0, (void*)&sp, sizeof(*sp)) < 0)
+    return -1;
+  if(old && argptr(1, (void*)&op, sizeof(*op)) < 0)
+    return -1;
+
+  return schedconf(sp, op);
+}
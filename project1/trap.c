@@ -3,16 +3,20 @@
 #include "param.h"
 #include "memlayout.h"
 #include "mmu.h"
+#include "spinlock.h"
 #include "proc.h"
 #include "x86.h"
 #include "traps.h"
-#include "spinlock.h"
+#include "schedstat.h"
+#include "schedconf.h"
+#include "mlfq.h"
 
 // Interrupt descriptor table (shared by all CPUs).
 struct gatedesc idt[256];
 extern uint vectors[];  // in vectors.S: array of 256 entry pointers
 struct spinlock tickslock;
 uint ticks;
+uint tickcycles;    // tsc cycles per tick, measured by cpu 0
 
 void
 tvinit(void)
@@ -34,6 +38,19 @@ idtinit(void)
   lidt(idt, sizeof(idt));
 }
 
+// measure tsc cycles per tick on cpu 0, smoothed over a few
+// ticks. a gap of 2^32 cycles or more (a stalled vm) is skipped.
+static void
+calibrate(void)
+{
+  static uint64 last;
+  uint64 now = rdtsc(), d = now - last;
+
+  if(last && d < 0xffffffff)
+    tickcycles = tickcycles ? tickcycles - tickcycles/4 + (uint)d/4 : d;
+  last = now;
+}
+
 //PAGEBREAK: 41
 void
 trap(struct trapframe *tf)
@@ -42,7 +59,9 @@ trap(struct trapframe *tf)
     cprintf("user interrupt 128 called!\n");
     exit();
   }
-  // fetch argument with argint and exec scheduler lock / unlock
+  // fetch argument with argint and exec scheduler lock / unlock.
+  // compatibility shims: the system calls reservecpu and
+  // releasecpu do the same without a password.
   if(tf->trapno == 129){
     if(myproc()->killed)
       exit();
@@ -72,6 +91,9 @@ trap(struct trapframe *tf)
     syscall();
     if(myproc()->killed)
       exit();
+    // the call woke a higher level process for this cpu
+    if(resched())
+      yield();
     return;
   }
 
@@ -79,17 +101,24 @@ trap(struct trapframe *tf)
   case T_IRQ0 + IRQ_TIMER:
     if(cpuid() == 0){
       acquire(&tickslock);
-      struct proc* p = myproc();
-      if(p) p->time_quantum++;
       ticks++;
+      calibrate();
       wakeup(&ticks);
-      if(ticks % 100 == 0) {
-        release(&tickslock);
-        priorityBoosting(p);
-      } else {
-        release(&tickslock);
-      }
-      
+      release(&tickslock);
+    }
+    // every cpu charges its own process on its own timer
+    if(myproc() && myproc()->state == RUNNING) {
+      if(tickcycles)
+        charge(myproc());
+      else
+        myproc()->time_quantum++;
+    }
+    // priority boosting is lazy: the running process is reset here
+    // once a new boost generation begins, queued ones when picked.
+    if(myproc()){
+      acquire(&myproc()->lock);
+      boostproc(myproc(), boostepoch(cpuid()));
+      release(&myproc()->lock);
     }
     lapiceoi();
     break;
@@ -97,6 +126,11 @@ trap(struct trapframe *tf)
     ideintr();
     lapiceoi();
     break;
+  case T_IRQ0 + IRQ_RESCHED:
+    // Woken out of hlt, the scheduler loop looks again;
+    // or asked to preempt, see below.
+    lapiceoi();
+    break;
   case T_IRQ0 + IRQ_IDE+1:
     // Bochs generates spurious IDE1 interrupts.
     break;
@@ -137,14 +171,26 @@ trap(struct trapframe *tf)
   if(myproc() && myproc()->killed && (tf->cs&3) == DPL_USER)
     exit();
 
+  // A cpu reservation that ran out goes back to the MLFQ.
+  if(myproc() && myproc()->state == RUNNING &&
+     tf->trapno == T_IRQ0+IRQ_TIMER &&
+     myproc()->lock_flag &&
+     (int)(ticks - myproc()->lockend) >= 0)
+    unlockcpu();
+
   // Force process to give up CPU on clock tick.
   // If interrupts were on while locks held, would need to check nlock.
   // if locked, don't yield
-  // if L2 process, don't yield until time_quantum = 8
+  // if L2 process, don't yield until its quantum is used up
   if(myproc() && myproc()->state == RUNNING &&
      tf->trapno == T_IRQ0+IRQ_TIMER &&
      myproc()->lock_flag == 0 &&
-     (myproc()->mlfq_level != 2 || myproc()->time_quantum == 8)) 
+     (myproc()->mlfq_level != 2 ||
+      myproc()->time_quantum >= mlfqconf.quantum[2]))
+    yield();
+
+  // A higher level process was made runnable for this cpu.
+  if(myproc() && myproc()->state == RUNNING && resched())
     yield();
 
   // Check if the process has been killed since we yielded
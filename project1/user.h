@@ -1,5 +1,7 @@
 struct stat;
 struct rtcdate;
+struct schedstat;
+struct schedconf;
 
 // system calls
 int fork(void);
@@ -29,6 +31,10 @@ int getLevel(void);
 int setPriority(uint pid, uint priority);
 int schedulerLock(uint password);
 int schedulerUnlock(uint password);
+int schedstat(int pid, struct schedstat*);
+int schedconf(struct schedconf* set, struct schedconf* old);
+int reservecpu(void);
+int releasecpu(void);
 
 // ulib.c
 int stat(const char*, struct stat*);
@@ -4,6 +4,7 @@
 #include "x86.h"
 #include "memlayout.h"
 #include "mmu.h"
+#include "spinlock.h"
 #include "proc.h"
 #include "elf.h"
 
@@ -21,12 +22,24 @@ seginit(void)
   // Cannot share a CODE descriptor for both kernel and user
   // because it would have to have DPL_USR, but the CPU forbids
   // an interrupt from CPL=0 to DPL=3.
-  c = &cpus[cpuid()];
+  // %gs is not set up yet, so mycpu() can't be used:
+  // find this cpu by its local APIC ID.
+  for(c = cpus; c < &cpus[ncpu]; c++)
+    if(c->apicid == lapicid())
+      break;
+  if(c == &cpus[ncpu])
+    panic("seginit: unknown apicid");
   c->gdt[SEG_KCODE] = SEG(STA_X|STA_R, 0, 0xffffffff, 0);
   c->gdt[SEG_KDATA] = SEG(STA_W, 0, 0xffffffff, 0);
   c->gdt[SEG_UCODE] = SEG(STA_X|STA_R, 0, 0xffffffff, DPL_USER);
   c->gdt[SEG_UDATA] = SEG(STA_W, 0, 0xffffffff, DPL_USER);
+
+  // Map cpu-local storage, c->self and c->proc, at %gs.
+  c->gdt[SEG_KCPU] = SEG(STA_W, &c->self, 8, 0);
   lgdt(c->gdt, sizeof(c->gdt));
+  loadgs(SEG_KCPU << 3);
+  c->self = c;
+  c->proc = 0;
 }
 
 // Return the address of the PTE in page table pgdir
@@ -117,6 +117,15 @@ sti(void)
   asm volatile("sti");
 }
 
+// Enable interrupts and halt until one arrives.  sti takes effect
+// after the next instruction, so an interrupt already pending is
+// taken by the hlt instead of being lost before it.
+static inline void
+stihlt(void)
+{
+  asm volatile("sti; hlt");
+}
+
 static inline uint
 xchg(volatile uint *addr, uint newval)
 {
@@ -144,6 +153,14 @@ lcr3(uint val)
   asm volatile("movl %0,%%cr3" : : "r" (val));
 }
 
+static inline uint64
+rdtsc(void)
+{
+  uint64 val;
+  asm volatile("rdtsc" : "=A" (val));
+  return val;
+}
+
 //PAGEBREAK: 36
 // Layout of the trap frame built on the stack by the
 // hardware and by trapasm.S, and passed to trap().
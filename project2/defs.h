@@ -1,6 +1,7 @@
 struct buf;
 struct context;
 struct file;
+struct files;
 struct inode;
 struct pipe;
 struct proc;
@@ -34,6 +35,16 @@ void            fileinit(void);
 int             fileread(struct file*, char*, int n);
 int             filestat(struct file*, struct stat*);
 int             filewrite(struct file*, char*, int n);
+struct files*   filesalloc(void);
+struct files*   filesdup(struct files*);
+struct files*   filescopy(struct files*);
+void            filesclose(struct files*);
+void            filesput(struct files*);
+struct inode*   filescwd(struct files*);
+struct inode*   fileschdir(struct files*, struct inode*);
+int             fdinstall(struct files*, struct file*);
+struct file*    fdlookup(struct files*, int);
+struct file*    fdremove(struct files*, int);
 
 // fs.c
 void            readsb(int dev, struct superblock *sb);
@@ -78,6 +89,7 @@ void            cmostime(struct rtcdate *r);
 int             lapicid(void);
 extern volatile uint*    lapic;
 void            lapiceoi(void);
+void            lapicipi(int, int);
 void            lapicinit(void);
 void            lapicstartap(uchar, uint);
 void            microdelay(int);
@@ -127,6 +139,9 @@ int             printprocesses(void);
 int             thread_create(thread_t *thread, void *(*start_routine)(void *), void *arg);
 void            thread_exit(void *retval);
 int             thread_join(thread_t thread, void **retval);
+int             futex_wait(int*, int);
+int             futex_wake(int*, int);
+int             settls(uint);
 
 // swtch.S
 void            swtch(struct context**, struct context*);
@@ -189,6 +204,8 @@ void            inituvm(pde_t*, char*, uint);
 int             loaduvm(pde_t*, char*, struct inode*, uint, uint);
 pde_t*          copyuvm(pde_t*, uint);
 void            switchuvm(struct proc*);
+void            lazyswitchuvm(struct proc*);
+void            switchtls(struct proc*);
 void            switchkvm(void);
 int             copyout(pde_t*, uint, void*, uint);
 void            clearpteu(pde_t *pgdir, char *uva);
@@ -101,6 +101,9 @@ exec(char *path, char **argv)
   curproc->stpgnum = 1;
   curproc->pgdir = pgdir;
   curproc->sz = sz;
+  curproc->nstkfree = 0;
+  curproc->tls = 0;
+  curproc->tf->fs = 0;
   curproc->tf->eip = elf.entry;  // main
   curproc->tf->esp = sp;
   switchuvm(curproc);
@@ -211,6 +214,9 @@ exec2(char *path, char **argv, int stacksize)
   curproc->stpgnum = stacksize;
   curproc->pgdir = pgdir;
   curproc->sz = sz;
+  curproc->nstkfree = 0;
+  curproc->tls = 0;
+  curproc->tf->fs = 0;
   curproc->tf->eip = elf.entry;  // main
   curproc->tf->esp = sp;
   switchuvm(curproc);
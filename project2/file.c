@@ -5,6 +5,7 @@
 #include "types.h"
 #include "defs.h"
 #include "param.h"
+#include "mmu.h"
 #include "fs.h"
 #include "spinlock.h"
 #include "sleeplock.h"
@@ -16,10 +17,17 @@ struct {
   struct file file[NFILE];
 } ftable;
 
+// files structs are carved out of kalloc() pages as needed.
+struct {
+  struct spinlock lock;
+  struct files *free;
+} fstable;
+
 void
 fileinit(void)
 {
   initlock(&ftable.lock, "ftable");
+  initlock(&fstable.lock, "fstable");
 }
 
 // Allocate a file structure.
@@ -155,3 +163,187 @@ filewrite(struct file *f, char *addr, int n)
   panic("filewrite");
 }
 
+// Allocate an empty files struct with one reference.
+struct files*
+filesalloc(void)
+{
+  struct files *fs;
+  char *page;
+
+  acquire(&fstable.lock);
+  if(fstable.free == 0){
+    if((page = kalloc()) == 0){
+      release(&fstable.lock);
+      return 0;
+    }
+    memset(page, 0, PGSIZE);
+    for(fs = (struct files*)page; (char*)(fs + 1) <= page + PGSIZE; fs++){
+      initlock(&fs->lock, "files");
+      fs->next = fstable.free;
+      fstable.free = fs;
+    }
+  }
+  fs = fstable.free;
+  fstable.free = fs->next;
+  release(&fstable.lock);
+
+  fs->ref = 1;
+  return fs;
+}
+
+// Add a reference to fs, for a new thread.
+struct files*
+filesdup(struct files *fs)
+{
+  acquire(&fs->lock);
+  if(fs->ref < 1)
+    panic("filesdup");
+  fs->ref++;
+  release(&fs->lock);
+  return fs;
+}
+
+// A copy of fs for a forked child, with the same files and
+// directory. Return 0 if out of memory.
+struct files*
+filescopy(struct files *fs)
+{
+  struct files *nfs;
+  int fd;
+
+  if((nfs = filesalloc()) == 0)
+    return 0;
+  acquire(&fs->lock);
+  for(fd = 0; fd < NOFILE; fd++)
+    if(fs->ofile[fd])
+      nfs->ofile[fd] = filedup(fs->ofile[fd]);
+  nfs->cwd = idup(fs->cwd);
+  release(&fs->lock);
+  return nfs;
+}
+
+// Close every file of fs and let go of its directory, leaving
+// it empty. Called by exit(): all threads of the process go.
+void
+filesclose(struct files *fs)
+{
+  struct file *f;
+  struct inode *cwd;
+  int fd;
+
+  for(fd = 0; fd < NOFILE; fd++)
+    if((f = fdremove(fs, fd)) != 0)
+      fileclose(f);
+
+  acquire(&fs->lock);
+  cwd = fs->cwd;
+  fs->cwd = 0;
+  release(&fs->lock);
+  if(cwd){
+    begin_op();
+    iput(cwd);
+    end_op();
+  }
+}
+
+// Drop a reference to fs. The last one closes what is left in
+// it and frees it; the others just count down, so a thread
+// exiting doesn't touch its files or the log.
+void
+filesput(struct files *fs)
+{
+  acquire(&fs->lock);
+  if(fs->ref < 1)
+    panic("filesput");
+  if(--fs->ref > 0){
+    release(&fs->lock);
+    return;
+  }
+  release(&fs->lock);
+
+  filesclose(fs);
+  acquire(&fstable.lock);
+  fs->next = fstable.free;
+  fstable.free = fs;
+  release(&fstable.lock);
+}
+
+// A new reference to the current directory of fs, or 0 if the
+// process is exiting and has let go of it.
+struct inode*
+filescwd(struct files *fs)
+{
+  struct inode *ip = 0;
+
+  acquire(&fs->lock);
+  if(fs->cwd)
+    ip = idup(fs->cwd);
+  release(&fs->lock);
+  return ip;
+}
+
+// Make ip, whose reference fs takes over, the current directory
+// of fs. Return the old one for the caller to iput().
+struct inode*
+fileschdir(struct files *fs, struct inode *ip)
+{
+  struct inode *old;
+
+  acquire(&fs->lock);
+  old = fs->cwd;
+  fs->cwd = ip;
+  release(&fs->lock);
+  return old;
+}
+
+// Put f in the lowest free descriptor of fs. Takes over the
+// file reference on success. Return -1 if all are in use.
+int
+fdinstall(struct files *fs, struct file *f)
+{
+  int fd;
+
+  acquire(&fs->lock);
+  for(fd = 0; fd < NOFILE; fd++){
+    if(fs->ofile[fd] == 0){
+      fs->ofile[fd] = f;
+      release(&fs->lock);
+      return fd;
+    }
+  }
+  release(&fs->lock);
+  return -1;
+}
+
+// The file open at descriptor fd of fs, or 0. The caller gets
+// a reference of its own, to fileclose() when done: a thread
+// sharing fs may close fd meanwhile.
+struct file*
+fdlookup(struct files *fs, int fd)
+{
+  struct file *f;
+
+  if(fd < 0 || fd >= NOFILE)
+    return 0;
+  acquire(&fs->lock);
+  if((f = fs->ofile[fd]) != 0)
+    filedup(f);
+  release(&fs->lock);
+  return f;
+}
+
+// Clear descriptor fd of fs and return the file that was open
+// there, with its reference, or 0.
+struct file*
+fdremove(struct files *fs, int fd)
+{
+  struct file *f;
+
+  if(fd < 0 || fd >= NOFILE)
+    return 0;
+  acquire(&fs->lock);
+  f = fs->ofile[fd];
+  fs->ofile[fd] = 0;
+  release(&fs->lock);
+  return f;
+}
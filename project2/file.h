@@ -8,6 +8,16 @@ struct file {
   uint off;
 };
 
+// Open files and current directory of a process, shared by all
+// of its threads.
+struct files {
+  struct spinlock lock;        // protects everything below here
+  int ref;                     // threads using it
+  struct file *ofile[NOFILE];  // Open files
+  struct inode *cwd;           // Current directory
+  struct files *next;          // on the free list
+};
+
 
 // in-memory copy of an inode
 struct inode {
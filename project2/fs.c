@@ -628,8 +628,8 @@ namex(char *path, int nameiparent, char *name)
 
   if(*path == '/')
     ip = iget(ROOTDEV, ROOTINO);
-  else
-    ip = idup(myproc()->cwd);
+  else if((ip = filescwd(myproc()->files)) == 0)
+    return 0;
 
   while((path = skipelem(path, name)) != 0){
     ilock(ip);
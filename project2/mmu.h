@@ -17,9 +17,11 @@
 #define SEG_UCODE 3  // user code
 #define SEG_UDATA 4  // user data+stack
 #define SEG_TSS   5  // this process's task state
+#define SEG_KCPU  6  // kernel per-cpu data, loaded in %gs
+#define SEG_UTLS  7  // this thread's local data, loaded in user %fs
 
 // cpu->gdt[NSEGS] holds the above segments.
-#define NSEGS     6
+#define NSEGS     8
 
 #ifndef __ASSEMBLER__
 // Segment Descriptor
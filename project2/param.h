@@ -1,4 +1,7 @@
-#define NPROC        64  // maximum number of processes
+#define NSLEEPQ      64  // sleep queues, hashed by channel
+#define NPIDHASH     64  // pid and tid index buckets
+#define NSTKFREE     32  // returned thread stacks a process keeps
+#define SIBRUN        4  // switches between sibling threads before others run
 #define KSTACKSIZE 4096  // size of per-process kernel stack
 #define NCPU          8  // maximum number of CPUs
 #define NOFILE       16  // open files per process
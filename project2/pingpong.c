@@ -0,0 +1,72 @@
+// Pipe ping-pong: two processes pass one byte back and forth,
+// so every round trip is two wakeups and two context switches.
+//
+//   pingpong [rounds]
+//
+// Prints one "key=value" line; compare kernels by their
+// cycles_per_round.
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+
+#define DEF_ROUNDS 10000
+
+static inline uint64
+rdtsc(void)
+{
+  uint lo, hi;
+
+  asm volatile("rdtsc" : "=a" (lo), "=d" (hi));
+  return ((uint64)hi << 32) | lo;
+}
+
+int
+main(int argc, char *argv[])
+{
+  int rounds = argc > 1 ? atoi(argv[1]) : DEF_ROUNDS;
+  int ping[2], pong[2], i, pid, start, end;
+  uint64 t0, t1;
+  char c = 0;
+
+  if(pipe(ping) < 0 || pipe(pong) < 0){
+    printf(2, "pingpong: pipe failed\n");
+    exit();
+  }
+
+  pid = fork();
+  if(pid < 0){
+    printf(2, "pingpong: fork failed\n");
+    exit();
+  }
+  if(pid == 0){
+    close(ping[1]);
+    close(pong[0]);
+    for(i = 0; i < rounds; i++){
+      if(read(ping[0], &c, 1) != 1)
+        break;
+      write(pong[1], &c, 1);
+    }
+    exit();
+  }
+
+  close(ping[0]);
+  close(pong[1]);
+  start = uptime();
+  t0 = rdtsc();
+  for(i = 0; i < rounds; i++){
+    write(ping[1], &c, 1);
+    if(read(pong[0], &c, 1) != 1)
+      break;
+  }
+  t1 = rdtsc();
+  end = uptime();
+  close(ping[1]);
+  close(pong[0]);
+  wait();
+
+  // no 64-bit division in user space: scale down first
+  printf(1, "bench=pingpong rounds=%d ticks=%d cycles_per_round=%d\n",
+         i, end - start, i ? (uint)((t1 - t0) >> 4) / i * 16 : 0);
+  exit();
+}
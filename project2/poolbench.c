@@ -0,0 +1,92 @@
+// Parallel sum on the uthread worker pool.
+//
+//   poolbench [maxworkers] [n] [rounds]
+//
+// Sums an array of n ints rounds times, split into CHUNK-sized
+// tasks, with pools of 1, 2, 4, ... maxworkers workers. Prints
+// one "key=value" line per pool size; run under CPUS=1..8 to
+// see how it scales.
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "uthread.h"
+
+#define DEF_WORKERS 4
+#define DEF_N       (1 << 20)
+#define DEF_ROUNDS  20
+#define CHUNK       (1 << 14)
+
+int *a;
+uint total;
+struct mutex totallock;
+
+void
+sumchunk(void *arg)
+{
+  int *p = arg, *e = arg;
+  uint sum = 0;
+
+  e += CHUNK;
+  if(e > a + DEF_N)
+    e = a + DEF_N;
+  for(; p < e; p++)
+    sum += *p;
+  mutex_lock(&totallock);
+  total += sum;
+  mutex_unlock(&totallock);
+}
+
+void
+run(int nworker, int n, int rounds, uint want)
+{
+  static struct pool pool;
+  int i, r, bad = 0, start, end;
+
+  if((nworker = pool_init(&pool, nworker)) < 0){
+    printf(2, "poolbench: pool_init failed\n");
+    return;
+  }
+  start = uptime();
+  for(r = 0; r < rounds; r++){
+    total = 0;
+    for(i = 0; i < n; i += CHUNK)
+      pool_submit(&pool, sumchunk, a + i);
+    pool_wait(&pool);
+    if(total != want)
+      bad++;
+  }
+  end = uptime();
+  pool_destroy(&pool);
+
+  printf(1, "bench=psum workers=%d n=%d rounds=%d ticks=%d bad=%d\n",
+         nworker, n, rounds, end - start, bad);
+}
+
+int
+main(int argc, char *argv[])
+{
+  int maxworkers = argc > 1 ? atoi(argv[1]) : DEF_WORKERS;
+  int n = argc > 2 ? atoi(argv[2]) : DEF_N;
+  int rounds = argc > 3 ? atoi(argv[3]) : DEF_ROUNDS;
+  uint want = 0;
+  int i, w;
+
+  if(n < 1 || n > DEF_N)
+    n = DEF_N;
+  if((a = malloc(DEF_N * sizeof(int))) == 0){
+    printf(2, "poolbench: out of memory\n");
+    exit();
+  }
+  for(i = 0; i < n; i++){
+    a[i] = i;
+    want += i;
+  }
+  for(; i < DEF_N; i++)
+    a[i] = 0;
+  mutex_init(&totallock);
+
+  for(w = 1; w <= maxworkers && w <= POOLMAX; w *= 2)
+    run(w, n, rounds, want);
+  exit();
+}
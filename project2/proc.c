@@ -4,22 +4,37 @@
 #include "memlayout.h"
 #include "mmu.h"
 #include "x86.h"
+#include "traps.h"
 #include "proc.h"
 #include "spinlock.h"
 
+// Procs are carved out of kalloc() pages as needed and never
+// given back; UNUSED ones wait on the free list. Everything
+// else is on the live list, which the loops below walk.
 struct {
   struct spinlock lock;
-  struct proc proc[NPROC];
+  struct proc *live;              // allocated procs, newest first
+  struct proc *free;              // UNUSED procs
+  struct proc *sleepq[NSLEEPQ];   // SLEEPING procs, hashed by chan
+  struct proc *pidhash[NPIDHASH]; // procs and threads, hashed by pid
+  struct proc *tidhash[NPIDHASH]; // threads, hashed by tid
 } ptable;
 
 static struct proc *initproc;
 
+#define PIDHASH(id) ((uint)(id) % NPIDHASH)
+
 int nextpid = 1;
 int nexttid = 1;
 extern void forkret(void);
 extern void trapret(void);
 
 static void wakeup1(void *chan);
+static void unsleep(struct proc *p);
+static void kickidle(void);
+static struct proc *nextproc(struct proc *p);
+static struct proc *nextsibling(struct proc *p);
+static void freeproc(struct proc *p);
 
 void
 pinit(void)
@@ -34,40 +49,192 @@ cpuid() {
 }
 
 // Must be called with interrupts disabled to avoid the caller being
-// rescheduled between reading lapicid and running through the loop.
+// rescheduled to another cpu while using the result.
 struct cpu*
 mycpu(void)
 {
-  int apicid, i;
-  
+  struct cpu *c;
+
   if(readeflags()&FL_IF)
     panic("mycpu called with interrupts enabled\n");
   
-  apicid = lapicid();
-  // APIC IDs are not guaranteed to be contiguous. Maybe we should have
-  // a reverse map, or reserve a register to store &cpus[i].
-  for (i = 0; i < ncpu; ++i) {
-    if (cpus[i].apicid == apicid)
-      return &cpus[i];
-  }
-  panic("unknown apicid\n");
+  asm volatile("movl %%gs:0, %0" : "=r" (c));
+  return c;
 }
 
-// Disable interrupts so that we are not rescheduled
-// while reading proc from the cpu structure
+// A single load from this cpu's %gs segment. No need to disable
+// interrupts: if we are moved to another cpu, its %gs:4 names
+// this same process.
 struct proc*
 myproc(void) {
-  struct cpu *c;
   struct proc *p;
-  pushcli();
-  c = mycpu();
-  p = c->proc;
-  popcli();
+
+  asm volatile("movl %%gs:4, %0" : "=r" (p));
   return p;
 }
 
+// Index p by pid, and by tid if it is a thread.
+// The ptable lock must be held.
+static void
+hashproc(struct proc *p)
+{
+  struct proc **h;
+
+  h = &ptable.pidhash[PIDHASH(p->pid)];
+  p->pidnext = *h;
+  *h = p;
+  if(p->isthread){
+    h = &ptable.tidhash[PIDHASH(p->tid)];
+    p->tidnext = *h;
+    *h = p;
+  }
+}
+
+// Take p out of the pid and tid index, if it is there.
+// The ptable lock must be held.
+static void
+unhashproc(struct proc *p)
+{
+  struct proc **pp;
+
+  for(pp = &ptable.pidhash[PIDHASH(p->pid)]; *pp; pp = &(*pp)->pidnext)
+    if(*pp == p){
+      *pp = p->pidnext;
+      break;
+    }
+  if(p->isthread)
+    for(pp = &ptable.tidhash[PIDHASH(p->tid)]; *pp; pp = &(*pp)->tidnext)
+      if(*pp == p){
+        *pp = p->tidnext;
+        break;
+      }
+  p->pidnext = p->tidnext = 0;
+}
+
+// Add thread p to its process's thread list.
+// The ptable lock must be held.
+static void
+linkthread(struct proc *p)
+{
+  struct proc *mp = p->parent;
+
+  p->tprev = 0;
+  p->tnext = mp->threads;
+  if(mp->threads)
+    mp->threads->tprev = p;
+  mp->threads = p;
+}
+
+// Take thread p off its process's thread list, if it is there.
+// The ptable lock must be held.
+static void
+unlinkthread(struct proc *p)
+{
+  if(p->tprev)
+    p->tprev->tnext = p->tnext;
+  else if(p->parent && p->parent->threads == p)
+    p->parent->threads = p->tnext;
+  if(p->tnext)
+    p->tnext->tprev = p->tprev;
+  p->tnext = p->tprev = 0;
+}
+
+// Carve a fresh page into UNUSED procs on the free list.
+// Return 0 if out of memory. The ptable lock must be held.
+static int
+moreprocs(void)
+{
+  struct proc *p;
+  char *page;
+
+  if((page = kalloc()) == 0)
+    return 0;
+  memset(page, 0, PGSIZE);
+  for(p = (struct proc*)page; (char*)(p + 1) <= page + PGSIZE; p++){
+    p->lnext = ptable.free;
+    ptable.free = p;
+  }
+  return 1;
+}
+
+// Free p's kernel stack and move it from the live list to the
+// free list. The caller frees its memory if p is not a thread.
+// The ptable lock must be held.
+static void
+freeproc(struct proc *p)
+{
+  struct proc *t, *next;
+
+  unhashproc(p);
+  if(p->isthread)
+    unlinkthread(p);
+  // threads left behind no longer have a list to be on
+  for(t = p->threads; t; t = next){
+    next = t->tnext;
+    t->tnext = t->tprev = 0;
+  }
+  p->threads = 0;
+  if(p->kstack)
+    kfree(p->kstack);
+  p->kstack = 0;
+  p->pid = 0;
+  p->parent = 0;
+  p->name[0] = 0;
+  p->killed = 0;
+  p->limit = 0;
+  p->stpgnum = 0;
+  p->tid = 0;
+  p->retval = 0;
+  p->isthread = 0;
+  p->ustack = 0;
+  p->nstkfree = 0;
+  p->tls = 0;
+  // a thread shares files with the process freeing it, so this
+  // is not the last reference and doesn't block (see wait)
+  if(p->files)
+    filesput(p->files);
+  p->files = 0;
+  p->state = UNUSED;
+
+  if(p->lprev)
+    p->lprev->lnext = p->lnext;
+  else
+    ptable.live = p->lnext;
+  if(p->lnext)
+    p->lnext->lprev = p->lprev;
+  p->lprev = 0;
+  p->lnext = ptable.free;
+  ptable.free = p;
+}
+
+// The process with pid, not one of its threads, or 0.
+// The ptable lock must be held.
+static struct proc*
+findproc(int pid)
+{
+  struct proc *p;
+
+  for(p = ptable.pidhash[PIDHASH(pid)]; p; p = p->pidnext)
+    if(p->pid == pid && p->isthread == 0)
+      return p;
+  return 0;
+}
+
+// The thread with tid, or 0.
+// The ptable lock must be held.
+static struct proc*
+findthread(int tid)
+{
+  struct proc *p;
+
+  for(p = ptable.tidhash[PIDHASH(tid)]; p; p = p->tidnext)
+    if(p->tid == tid)
+      return p;
+  return 0;
+}
+
 //PAGEBREAK: 32
-// Look in the process table for an UNUSED proc.
+// Take an UNUSED proc off the free list, growing it if empty.
 // If found, change state to EMBRYO and initialize
 // state required to run in the kernel.
 // Otherwise return 0.
@@ -79,27 +246,34 @@ allocproc(int mode)
 
   acquire(&ptable.lock);
 
-  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++)
-    if(p->state == UNUSED)
-      goto found;
-
-  release(&ptable.lock);
-  return 0;
+  if(ptable.free == 0 && !moreprocs()){
+    release(&ptable.lock);
+    return 0;
+  }
+  p = ptable.free;
+  ptable.free = p->lnext;
+  p->lprev = 0;
+  p->lnext = ptable.live;
+  if(ptable.live)
+    ptable.live->lprev = p;
+  ptable.live = p;
 
-found:
   p->state = EMBRYO;
   if(mode == 1) 
     p->isthread = 1;
   else {
     p->pid = nextpid++;
     p->isthread = 0;
+    hashproc(p);
   }
 
   release(&ptable.lock);
 
   // Allocate kernel stack.
   if((p->kstack = kalloc()) == 0){
-    p->state = UNUSED;
+    acquire(&ptable.lock);
+    freeproc(p);
+    release(&ptable.lock);
     return 0;
   }
   sp = p->kstack + KSTACKSIZE;
@@ -146,7 +320,9 @@ userinit(void)
   p->tf->eip = 0;  // beginning of initcode.S
 
   safestrcpy(p->name, "initcode", sizeof(p->name));
-  p->cwd = namei("/");
+  if((p->files = filesalloc()) == 0)
+    panic("userinit: out of memory?");
+  fileschdir(p->files, namei("/"));
 
   // this assignment to p->state lets other cores
   // run this process. the acquire forces the above
@@ -155,6 +331,7 @@ userinit(void)
   acquire(&ptable.lock);
 
   p->state = RUNNABLE;
+  kickidle();
 
   release(&ptable.lock);
 }
@@ -178,6 +355,8 @@ growproc(int n)
   } else if(n < 0){
     if((sz = deallocuvm(curproc->pgdir, sz, sz + n)) == 0)
       return -1;
+    // siblings on other cpus flush at their next switch
+    curproc->vmgen++;
   }
   curproc->sz = sz;
   switchuvm(cp);
@@ -187,26 +366,19 @@ growproc(int n)
 //in exec, clear process's thread and remain main thread
 int
 clearproc(int pid) {
-  struct proc *p, *curproc = myproc();
+  struct proc *p, *next, *mp = myproc(), *curproc = myproc();
 
   acquire(&ptable.lock);
 
-  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
-    if(p->pid == curproc->pid && p->isthread && p->tid != curproc->tid){
-      // Found one.
-      kfree(p->kstack);
-      p->kstack = 0;
-      p->pid = 0;
-      p->parent = 0;
-      p->name[0] = 0;
-      p->killed = 0;
-      p->limit = 0;
-      p->stpgnum = 0;
-      p->tid = 0;
-      p->retval = 0;
-      p->isthread = 0;
-      p->state = UNUSED;
-    }
+  while(mp->isthread) mp = mp->parent;
+  for(p = mp->threads; p; p = next){
+    // freeing p takes it off the list
+    next = p->tnext;
+    if(p == curproc)
+      continue;
+    if(p->state == SLEEPING)
+      unsleep(p);
+    freeproc(p);
   }
 
   release(&ptable.lock);
@@ -219,7 +391,7 @@ clearproc(int pid) {
 int
 fork(void)
 {
-  int i, pid;
+  int pid;
   struct proc *np;
   struct proc *curproc = myproc();
 
@@ -229,24 +401,23 @@ fork(void)
   }
 
   // Copy process state from proc.
-  if((np->pgdir = copyuvm(curproc->pgdir, curproc->sz)) == 0){
-    kfree(np->kstack);
-    np->kstack = 0;
-    np->state = UNUSED;
+  if((np->pgdir = copyuvm(curproc->pgdir, curproc->sz)) == 0 ||
+     (np->files = filescopy(curproc->files)) == 0){
+    if(np->pgdir)
+      freevm(np->pgdir);
+    acquire(&ptable.lock);
+    freeproc(np);
+    release(&ptable.lock);
     return -1;
   }
   np->sz = curproc->sz;
   np->parent = curproc;
   *np->tf = *curproc->tf;
+  np->tls = curproc->tls;
 
   // Clear %eax so that fork returns 0 in the child.
   np->tf->eax = 0;
 
-  for(i = 0; i < NOFILE; i++)
-    if(curproc->ofile[i])
-      np->ofile[i] = filedup(curproc->ofile[i]);
-  np->cwd = idup(curproc->cwd);
-
   safestrcpy(np->name, curproc->name, sizeof(curproc->name));
 
   pid = np->pid;
@@ -254,6 +425,7 @@ fork(void)
   acquire(&ptable.lock);
 
   np->state = RUNNABLE;
+  kickidle();
 
   release(&ptable.lock);
 
@@ -266,57 +438,56 @@ fork(void)
 void
 exit(void)
 {
-  struct proc *curproc = myproc(), *parent = myproc();
-  struct proc *p;
-  int fd;
+  struct proc *curproc = myproc(), *mp = myproc();
+  struct proc *p, *next;
 
   if(curproc == initproc)
     panic("init exiting");
 
-  // Close all open files.
-  for(fd = 0; fd < NOFILE; fd++){
-    if(curproc->ofile[fd]){
-      fileclose(curproc->ofile[fd]);
-      curproc->ofile[fd] = 0;
-    }
-  }
-
-  begin_op();
-  iput(curproc->cwd);
-  end_op();
-  curproc->cwd = 0;
+  // Close all open files, the other threads' too.
+  filesclose(curproc->files);
 
   acquire(&ptable.lock);
 
-  while(parent->isthread) parent = parent->parent;
+  while(mp->isthread) mp = mp->parent;
 
   // Parent might be sleeping in wait().
-  wakeup1(parent->parent);
-
-  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
-    //clean up process's other thread
-    if(p->pid == curproc->pid && p->tid != curproc->tid) {
-      kfree(p->kstack);
-      p->kstack = 0;
-      p->pid = 0;
-      p->parent = 0;
-      p->name[0] = 0;
-      p->killed = 0;
-      p->limit = 0;
-      p->stpgnum = 0;
-      p->tid = 0;
-      p->retval = 0;
-      p->isthread = 0;
-      p->state = UNUSED;
-    }
-    // Pass abandoned children to init.
-    if(p->parent == curproc){
+  wakeup1(mp->parent);
+
+  // Pass abandoned children of any of the threads to init.
+  for(p = ptable.live; p; p = p->lnext){
+    if(p->pid != mp->pid && p->parent && p->parent->pid == mp->pid){
       p->parent = initproc;
       if(p->state == ZOMBIE)
         wakeup1(initproc);
     }
   }
 
+  //clean up process's other thread
+  for(p = mp->threads; p; p = next){
+    // freeing p takes it off the list
+    next = p->tnext;
+    if(p == curproc)
+      continue;
+    if(p->state == SLEEPING)
+      unsleep(p);
+    freeproc(p);
+  }
+
+  // A thread calling exit() stays behind as the process's
+  // zombie, for the parent's wait() to reap.
+  if(curproc != mp){
+    unlinkthread(curproc);
+    unhashproc(curproc);
+    curproc->isthread = 0;
+    curproc->tid = 0;
+    curproc->parent = mp->parent;
+    if(mp->state == SLEEPING)
+      unsleep(mp);
+    freeproc(mp);
+    hashproc(curproc);
+  }
+
   // Jump into the scheduler, never to return.
   curproc->state = ZOMBIE;
   sched();
@@ -329,6 +500,7 @@ int
 wait(void)
 {
   struct proc *p;
+  struct files *fs;
   int havekids, pid;
   struct proc *curproc = myproc();
   
@@ -336,27 +508,22 @@ wait(void)
   for(;;){
     // Scan through table looking for exited children.
     havekids = 0;
-    for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
-      if(p->parent != curproc)
+    for(p = ptable.live; p; p = p->lnext){
+      // threads are reaped by thread_join() instead
+      if(p->parent != curproc || p->isthread)
         continue;
       havekids = 1;
       if(p->state == ZOMBIE){
         // Found one.
         pid = p->pid;
-        kfree(p->kstack);
-        p->kstack = 0;
+        fs = p->files;
+        p->files = 0;
         freevm(p->pgdir);
-        p->pid = 0;
-        p->parent = 0;
-        p->name[0] = 0;
-        p->killed = 0;
-        p->limit = 0;
-        p->stpgnum = 0;
-        p->tid = 0;
-        p->retval = 0;
-        p->isthread = 0;
-        p->state = UNUSED;
+        freeproc(p);
         release(&ptable.lock);
+        // emptied by exit(), so this doesn't block
+        if(fs)
+          filesput(fs);
         return pid;
       }
     }
@@ -372,6 +539,38 @@ wait(void)
   }
 }
 
+// Scheduler found nothing runnable: halt until an interrupt,
+// unless someone already cleared c->idle to kick us.
+static void
+idle(struct cpu *c)
+{
+  uint64 start;
+
+  cli();
+  if(c->idle){
+    c->nhalt++;
+    start = rdtsc();
+    stihlt();
+    c->idlecycles += rdtsc() - start;
+  }
+  c->idle = 0;
+}
+
+// A process just became RUNNABLE: wake one halted cpu to run it.
+// Caller holds ptable.lock.
+static void
+kickidle(void)
+{
+  struct cpu *c;
+
+  for(c = cpus; c < &cpus[ncpu]; c++){
+    if(c != mycpu() && xchg(&c->idle, 0)){
+      lapicipi(c->apicid, T_IRQ0 + IRQ_RESCHED);
+      return;
+    }
+  }
+}
+
 //PAGEBREAK: 42
 // Per-CPU process scheduler.
 // Each CPU calls scheduler() after setting itself up.
@@ -385,6 +584,7 @@ scheduler(void)
 {
   struct proc *p;
   struct cpu *c = mycpu();
+  int ran;
   c->proc = 0;
   
   for(;;){
@@ -392,27 +592,43 @@ scheduler(void)
     sti();
 
     // Loop over process table looking for process to run.
+    ran = 0;
     acquire(&ptable.lock);
-    for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
+    for(p = ptable.live; p; p = p->lnext){
       if(p->state != RUNNABLE)
         continue;
 
       // Switch to chosen process.  It is the process's job
       // to release ptable.lock and then reacquire it
       // before jumping back to us.
+      ran = 1;
       c->proc = p;
-      switchuvm(p);
+      lazyswitchuvm(p);
       p->state = RUNNING;
 
       swtch(&(c->scheduler), p->context);
-      switchkvm();
 
       // Process is done running for now.
       // It should have changed its p->state before coming back.
+      // After direct switches in sched() that may be another
+      // process than p; it is still live, so go on after it.
+      p = c->proc;
       c->proc = 0;
     }
+    // The last page table stays loaded while ptable.lock is
+    // held, so the next process can keep it; drop it before
+    // letting go, as wait() or exec() may free it.
+    if(ran)
+      switchkvm();
+    // Nothing was runnable: announce idle while still holding
+    // ptable.lock, so whoever makes a process RUNNABLE next
+    // sees the flag and kicks us (see kickidle).
+    if(!ran)
+      c->idle = 1;
     release(&ptable.lock);
 
+    if(!ran)
+      idle(c);
   }
 }
 
@@ -427,7 +643,7 @@ void
 sched(void)
 {
   int intena;
-  struct proc *p = myproc();
+  struct proc *p = myproc(), *np;
 
   if(!holding(&ptable.lock))
     panic("sched ptable.lock");
@@ -438,10 +654,69 @@ sched(void)
   if(readeflags()&FL_IF)
     panic("sched interruptible");
   intena = mycpu()->intena;
-  swtch(&p->context, mycpu()->scheduler);
+  // Fast path: switch straight to the next RUNNABLE process,
+  // or keep running if that is p itself. Only when there is
+  // none does the scheduler loop run, to idle.
+  // Another thread of p's process goes first, up to SIBRUN
+  // times in a row, as switching to it keeps the TLB.
+  np = 0;
+  if(mycpu()->nsibrun < SIBRUN && (np = nextsibling(p)) != 0)
+    mycpu()->nsibrun++;
+  else
+    mycpu()->nsibrun = 0;
+  if(np == 0 && (np = nextproc(p)) == 0)
+    swtch(&p->context, mycpu()->scheduler);
+  else {
+    mycpu()->proc = np;
+    np->state = RUNNING;
+    if(np != p){
+      lazyswitchuvm(np);
+      swtch(&p->context, np->context);
+    }
+  }
   mycpu()->intena = intena;
 }
 
+// The RUNNABLE process after p in live list order, wrapping
+// around to p itself, as the scheduler loop would pick it; or 0.
+// The ptable lock must be held.
+static struct proc*
+nextproc(struct proc *p)
+{
+  struct proc *np = p;
+
+  do {
+    if((np = np->lnext) == 0)
+      np = ptable.live;
+    if(np->state == RUNNABLE)
+      return np;
+  } while(np != p);
+  return 0;
+}
+
+// A RUNNABLE thread of p's process other than p, going round
+// its thread list and the main thread from p, or 0.
+// The ptable lock must be held.
+static struct proc*
+nextsibling(struct proc *p)
+{
+  struct proc *mp = p, *np = p;
+
+  while(mp->isthread) mp = mp->parent;
+  // p must be on mp's list for the walk to come back to it
+  if(mp->threads == 0 || (p != mp && p->tprev == 0 && mp->threads != p))
+    return 0;
+  do {
+    if(np == mp)
+      np = mp->threads;
+    else if((np = np->tnext) == 0)
+      np = mp;
+    if(np->state == RUNNABLE && np != p)
+      return np;
+  } while(np != p);
+  return 0;
+}
+
 // Give up the CPU for one scheduling round.
 void
 yield(void)
@@ -473,12 +748,36 @@ forkret(void)
   // Return to "caller", actually trapret (see allocproc)0.
 }
 
+// Sleep queue of chan. Sleepers on channels that hash
+// alike share a queue, so wakeup1 still checks p->chan.
+static struct proc**
+sleepq(void *chan)
+{
+  return &ptable.sleepq[((uint)chan * 2654435761U >> 16) % NSLEEPQ];
+}
+
+// Take SLEEPING p off its sleep queue without waking it.
+// The ptable lock must be held.
+static void
+unsleep(struct proc *p)
+{
+  struct proc **pp;
+
+  for(pp = sleepq(p->chan); *pp; pp = &(*pp)->snext)
+    if(*pp == p){
+      *pp = p->snext;
+      p->snext = 0;
+      return;
+    }
+}
+
 // Atomically release lock and sleep on chan.
 // Reacquires lock when awakened.
 void
 sleep(void *chan, struct spinlock *lk)
 {
   struct proc *p = myproc();
+  struct proc **pp;
   
   if(p == 0)
     panic("sleep");
@@ -498,6 +797,10 @@ sleep(void *chan, struct spinlock *lk)
   }
   // Go to sleep.
   p->chan = chan;
+  for(pp = sleepq(chan); *pp; pp = &(*pp)->snext)
+    ;
+  *pp = p;
+  p->snext = 0;
   p->state = SLEEPING;
 
   sched();
@@ -518,11 +821,22 @@ sleep(void *chan, struct spinlock *lk)
 static void
 wakeup1(void *chan)
 {
-  struct proc *p;
-
-  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++)
-    if(p->state == SLEEPING && p->chan == chan)
+  struct proc *p, **pp;
+  int woke = 0;
+
+  // only chan's queue is looked at; everything on it is SLEEPING
+  pp = sleepq(chan);
+  while((p = *pp) != 0){
+    if(p->chan == chan){
+      *pp = p->snext;
+      p->snext = 0;
       p->state = RUNNABLE;
+      woke = 1;
+    } else
+      pp = &p->snext;
+  }
+  if(woke)
+    kickidle();
 }
 
 // Wake up all processes sleeping on chan.
@@ -534,6 +848,93 @@ wakeup(void *chan)
   release(&ptable.lock);
 }
 
+// A futex is named by a user address in a page table. Its wait
+// channel is the kernel address of the word, which is unique
+// to the (pgdir, addr) pair, so futex sleepers share the hashed
+// sleep queues with everyone else. Return 0 if addr is not an
+// aligned word of curproc's user memory.
+static int*
+futexaddr(struct proc *curproc, uint addr)
+{
+  struct proc *mp = curproc;
+  char *page;
+
+  while(mp->isthread) mp = mp->parent;
+  if(addr % sizeof(int) != 0 || addr >= mp->sz)
+    return 0;
+  if((page = uva2ka(curproc->pgdir, (char*)addr)) == 0)
+    return 0;
+  return (int*)(page + (addr & (PGSIZE-1)));
+}
+
+// Sleep on the futex at addr if it still holds val.
+// Return 0 once woken or if it already changed, -1 if addr
+// is bad or the caller was killed.
+int
+futex_wait(int *addr, int val)
+{
+  struct proc *curproc = myproc();
+  int *kaddr;
+
+  if((kaddr = futexaddr(curproc, (uint)addr)) == 0)
+    return -1;
+
+  // futex_wake takes ptable.lock too, so no wakeup is lost
+  // between the check and going to sleep.
+  acquire(&ptable.lock);
+  if(curproc->killed){
+    release(&ptable.lock);
+    return -1;
+  }
+  if(*kaddr == val)
+    sleep(kaddr, &ptable.lock);
+  release(&ptable.lock);
+  return 0;
+}
+
+// Wake up to n sleepers on the futex at addr, oldest first.
+// Return how many were woken, or -1 if addr is bad.
+int
+futex_wake(int *addr, int n)
+{
+  struct proc *p, **pp;
+  int *kaddr;
+  int woke = 0;
+
+  if((kaddr = futexaddr(myproc(), (uint)addr)) == 0)
+    return -1;
+
+  acquire(&ptable.lock);
+  pp = sleepq(kaddr);
+  while((p = *pp) != 0 && woke < n){
+    if(p->chan == kaddr){
+      *pp = p->snext;
+      p->snext = 0;
+      p->state = RUNNABLE;
+      woke++;
+    } else
+      pp = &p->snext;
+  }
+  if(woke)
+    kickidle();
+  release(&ptable.lock);
+  return woke;
+}
+
+// Make base the start of the calling thread's %fs segment,
+// so that %fs-relative loads reach its thread-local data.
+// base 0 leaves %fs null again.
+int
+settls(uint base)
+{
+  struct proc *curproc = myproc();
+
+  curproc->tls = base;
+  curproc->tf->fs = base ? (SEG_UTLS << 3) | DPL_USER : 0;
+  switchtls(curproc);
+  return 0;
+}
+
 // Kill the process with the given pid.
 // Process won't exit until it returns
 // to user space (see trap in trap.c).
@@ -543,15 +944,16 @@ kill(int pid)
   struct proc *p;
 
   acquire(&ptable.lock);
-  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
-    if(p->pid == pid && p->isthread == 0){
-      p->killed = 1;
-      // Wake process from sleep if necessary.
-      if(p->state == SLEEPING)
-        p->state = RUNNABLE;
-      release(&ptable.lock);
-      return 0;
+  if((p = findproc(pid)) != 0){
+    p->killed = 1;
+    // Wake process from sleep if necessary.
+    if(p->state == SLEEPING){
+      unsleep(p);
+      p->state = RUNNABLE;
+      kickidle();
     }
+    release(&ptable.lock);
+    return 0;
   }
   release(&ptable.lock);
   return -1;
@@ -577,7 +979,7 @@ procdump(void)
   char *state;
   uint pc[10];
 
-  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
+  for(p = ptable.live; p; p = p->lnext){
     if(p->state == UNUSED)
       continue;
     if(p->state >= 0 && p->state < NELEM(states) && states[p->state])
@@ -592,6 +994,9 @@ procdump(void)
     }
     cprintf("\n");
   }
+  for(i = 0; i < ncpu; i++)
+    cprintf("cpu%d: halts %d idle %d Mcycles\n",
+            i, cpus[i].nhalt, (uint)(cpus[i].idlecycles >> 20));
 }
 
 //set process memory limit by just set proc structure's limit variable
@@ -606,9 +1011,7 @@ setmemorylimit(int pid, int limit) {
 
   acquire(&ptable.lock);
 
-  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
-    if(p->pid != pid || p->isthread) continue;
-    if(p->sz > limit) break;
+  if((p = findproc(pid)) != 0 && p->sz <= limit){
     p->limit = limit;
     ret = 0;
   }
@@ -626,7 +1029,7 @@ printprocesses(void) {
 
   acquire(&ptable.lock);
 
-  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
+  for(p = ptable.live; p; p = p->lnext){
     if(p->isthread) continue;
     if(p->state == RUNNABLE || p->state == RUNNING) {
       cprintf("process name: %s process id: %d stack page: %d process memory: %d process memory limit: %d\n",p->name,p->pid,p->stpgnum,p->sz,p->limit);
@@ -638,9 +1041,52 @@ printprocesses(void) {
   return 0;
 }
 
+// A two-page stack slot for a new thread of process curproc:
+// a returned one if any, else fresh space at the end of memory.
+// The lower page is a guard. Return the slot's address, or 0 if
+// out of memory.
+static uint
+stackalloc(struct proc *curproc)
+{
+  uint base = 0, sz;
+
+  acquire(&ptable.lock);
+  if(curproc->nstkfree > 0)
+    base = curproc->stkfree[--curproc->nstkfree];
+  release(&ptable.lock);
+
+  if(base == 0){
+    sz = PGROUNDUP(curproc->sz);
+    if((curproc->sz = allocuvm(curproc->pgdir, sz, sz + 2*PGSIZE)) == 0){
+      curproc->sz = sz;
+      return 0;
+    }
+    base = sz;
+    clearpteu(curproc->pgdir, (char*)base);
+  }
+  return base;
+}
+
+// Give thread p's stack slot back to its process, pages and
+// all: the slot lies below sz, which must stay fully mapped
+// for copyuvm and the system call argument checks. Once
+// NSTKFREE slots are parked, further ones are just forgotten.
+// The ptable lock must be held.
+static void
+stackfree(struct proc *p)
+{
+  struct proc *mp = p->parent;
+  uint base = p->ustack;
+
+  if(base == 0)
+    return;
+  p->ustack = 0;
+  if(mp->nstkfree < NSTKFREE)
+    mp->stkfree[mp->nstkfree++] = base;
+}
+
 //create thread like fork() + exec()
 int thread_create(thread_t *thread, void *(*start_routine)(void *), void *arg) {
-  int i;
   struct proc *np;
   struct proc *curproc = myproc(), *cp = myproc();
   uint sp, ustack[3+MAXARG+1];
@@ -653,11 +1099,13 @@ int thread_create(thread_t *thread, void *(*start_routine)(void *), void *arg) {
   while(curproc->isthread) curproc = curproc->parent;
 
   // Allocate thread stack, guard page
-  curproc->sz = PGROUNDUP(curproc->sz);
-  if((curproc->sz = allocuvm(curproc->pgdir, curproc->sz, curproc->sz+2*PGSIZE)) == 0){
+  if((np->ustack = stackalloc(curproc)) == 0){
+    acquire(&ptable.lock);
+    freeproc(np);
+    release(&ptable.lock);
     return -1;
   }
-  sp = curproc->sz;
+  sp = np->ustack + 2*PGSIZE;
 
   // set thread's variable
   np->sz = curproc->sz;
@@ -665,11 +1113,9 @@ int thread_create(thread_t *thread, void *(*start_routine)(void *), void *arg) {
   np->pgdir = curproc->pgdir;
   np->parent = curproc;
   *np->tf = *curproc->tf;
-
-  for(i = 0; i < NOFILE; i++)
-    if(curproc->ofile[i])
-      np->ofile[i] = filedup(curproc->ofile[i]);
-  np->cwd = idup(curproc->cwd);
+  np->files = filesdup(curproc->files);
+  // no thread-local data until the thread calls settls()
+  np->tf->fs = 0;
 
   //set parameter in start routin
   ustack[0] = 0xffffffff;  // fake return PC
@@ -677,8 +1123,13 @@ int thread_create(thread_t *thread, void *(*start_routine)(void *), void *arg) {
 
   sp -= 8;
 
-  if(copyout(np->pgdir, sp, ustack, 8) < 0)
+  if(copyout(np->pgdir, sp, ustack, 8) < 0){
+    acquire(&ptable.lock);
+    stackfree(np);
+    freeproc(np);
+    release(&ptable.lock);
     return -1;
+  }
 
   safestrcpy(np->name, curproc->name, sizeof(curproc->name));
 
@@ -692,8 +1143,11 @@ int thread_create(thread_t *thread, void *(*start_routine)(void *), void *arg) {
   acquire(&ptable.lock);
 
   np->state = RUNNABLE;
+  kickidle();
   np->tid = nexttid;
   *thread = nexttid++;
+  hashproc(np);
+  linkthread(np);
 
   release(&ptable.lock);
 
@@ -704,31 +1158,25 @@ int thread_create(thread_t *thread, void *(*start_routine)(void *), void *arg) {
 void thread_exit(void *retval) {
   struct proc *curproc = myproc();
   struct proc *p;
-  int fd;
 
   if(curproc == initproc)
     panic("init exiting");
 
-  // Close all open files.
-  for(fd = 0; fd < NOFILE; fd++){
-    if(curproc->ofile[fd]){
-      fileclose(curproc->ofile[fd]);
-      curproc->ofile[fd] = 0;
-    }
-  }
-
-  begin_op();
-  iput(curproc->cwd);
-  end_op();
-  curproc->cwd = 0;
+  // Let go of the files shared with the other threads, which
+  // keep them open.
+  filesput(curproc->files);
+  curproc->files = 0;
 
   acquire(&ptable.lock);
 
-  // Parent might be sleeping in wait().
-  wakeup1(curproc->parent);
+  // A joiner might be sleeping in thread_join(); the parent
+  // only waits for a main thread.
+  wakeup1(&curproc->retval);
+  if(!curproc->isthread)
+    wakeup1(curproc->parent);
 
   // Pass abandoned children to init.
-  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
+  for(p = ptable.live; p; p = p->lnext){
     if(p->parent == curproc){
       p->parent = initproc;
       if(p->state == ZOMBIE)
@@ -736,6 +1184,7 @@ void thread_exit(void *retval) {
     }
   }
 
+  stackfree(curproc);
   curproc->state = ZOMBIE;
   // Set retval variable that uses for thread_join
   curproc->retval = retval;
@@ -752,27 +1201,14 @@ int thread_join(thread_t thread, void **retval) {
   
   acquire(&ptable.lock);
   for(;;){
-    // Scan through table looking for exited children.
+    // Look the thread up by tid.
     havekids = 0;
-    for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
-      if(p->tid != thread)
-        continue;
+    if((p = findthread(thread)) != 0){
       havekids = 1;
       if(p->state == ZOMBIE){
         // Found one.
         *retval = p->retval;
-        kfree(p->kstack);
-        p->kstack = 0;
-        p->pid = 0;
-        p->parent = 0;
-        p->name[0] = 0;
-        p->killed = 0;
-        p->limit = 0;
-        p->stpgnum = 0;
-        p->tid = 0;
-        p->retval = 0;
-        p->isthread = 0;
-        p->state = UNUSED;
+        freeproc(p);
         release(&ptable.lock);
         return 0;
       }
@@ -784,7 +1220,7 @@ int thread_join(thread_t thread, void **retval) {
       return -1;
     }
 
-    // Wait for children to exit.  (See wakeup1 call in proc_exit.)
-    sleep(curproc, &ptable.lock);  //DOC: wait-sleep
+    // Wait for this thread to exit.  (See thread_exit.)
+    sleep(&p->retval, &ptable.lock);
   }
 }
\ No newline at end of file
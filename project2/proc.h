@@ -1,4 +1,5 @@
-// Per-CPU state
+// Per-CPU state, one cache line or more each so that cpus
+// don't share lines in cpus[].
 struct cpu {
   uchar apicid;                // Local APIC ID
   struct context *scheduler;   // swtch() here to enter scheduler
@@ -7,8 +8,16 @@ struct cpu {
   volatile uint started;       // Has the CPU started?
   int ncli;                    // Depth of pushcli nesting.
   int intena;                  // Were interrupts enabled before pushcli?
+  // Cpu-local storage: %gs points at self, so self is %gs:0
+  // and proc is %gs:4 (see seginit, mycpu and myproc).
+  struct cpu *self;            // This struct
   struct proc *proc;           // The process running on this cpu or null
-};
+  volatile uint idle;          // Halted in scheduler, waiting for a kick
+  uint nsibrun;                // Sibling thread switches in a row (see sched)
+  uint vmgen;                  // vmgen of the address space in %cr3
+  uint nhalt;                  // Times this cpu went idle
+  uint64 idlecycles;           // Tsc cycles spent halted
+} __attribute__((aligned(64)));
 
 extern struct cpu cpus[NCPU];
 extern int ncpu;
@@ -45,15 +54,27 @@ struct proc {
   struct trapframe *tf;        // Trap frame for current syscall
   struct context *context;     // swtch() here to run process
   void *chan;                  // If non-zero, sleeping on chan
+  struct proc *snext;          // Next sleeper in chan's sleep queue
+  struct proc *pidnext;        // Next proc in pid's index bucket
+  struct proc *tidnext;        // Next thread in tid's index bucket
+  struct proc *lnext;          // Next live proc, or next on the free list
+  struct proc *lprev;          // Previous live proc
   int killed;                  // If non-zero, have been killed
-  struct file *ofile[NOFILE];  // Open files
-  struct inode *cwd;           // Current directory
+  struct files *files;         // Open files and cwd, shared by threads
   char name[16];               // Process name (debugging)
   int limit;                   // Process memory limit
   int stpgnum;                 // Count of stack page 
   int isthread;                // Check it is main thread
   int tid;                     // Thread ID
-  void* retval;                // Return value
+  void* retval;                // Return value; &retval is the join channel
+  struct proc *threads;        // Threads of this process (process only)
+  struct proc *tnext;          // Next thread of the same process
+  struct proc *tprev;          // Previous thread of the same process
+  uint ustack;                 // Thread's user stack slot, guard page first
+  uint stkfree[NSTKFREE];      // Returned thread stack slots (process only)
+  int nstkfree;
+  uint tls;                    // Base of user %fs segment (thread-local data)
+  uint vmgen;                  // Bumped when pages are unmapped (process only)
 };
 
 // Process memory is laid out contiguously, low addresses first:
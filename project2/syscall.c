@@ -109,6 +109,9 @@ extern int sys_printprocesses(void);
 extern int sys_thread_create(void);
 extern int sys_thread_exit(void);
 extern int sys_thread_join(void);
+extern int sys_futex_wait(void);
+extern int sys_futex_wake(void);
+extern int sys_settls(void);
 
 static int (*syscalls[])(void) = {
 [SYS_fork]    sys_fork,
@@ -138,6 +141,9 @@ static int (*syscalls[])(void) = {
 [SYS_thread_create]   sys_thread_create,
 [SYS_thread_exit]   sys_thread_exit,
 [SYS_thread_join]   sys_thread_join,
+[SYS_futex_wait]   sys_futex_wait,
+[SYS_futex_wake]   sys_futex_wake,
+[SYS_settls]   sys_settls,
 };
 
 void
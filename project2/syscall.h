@@ -26,3 +26,6 @@
 #define SYS_thread_create  25
 #define SYS_thread_exit  26
 #define SYS_thread_join  27
+#define SYS_futex_wait  28
+#define SYS_futex_wake  29
+#define SYS_settls  30
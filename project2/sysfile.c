@@ -18,6 +18,7 @@
 
 // Fetch the nth word-sized system call argument as a file descriptor
 // and return both the descriptor and the corresponding struct file.
+// The file comes with a reference for the caller to fileclose().
 static int
 argfd(int n, int *pfd, struct file **pf)
 {
@@ -26,7 +27,7 @@ argfd(int n, int *pfd, struct file **pf)
 
   if(argint(n, &fd) < 0)
     return -1;
-  if(fd < 0 || fd >= NOFILE || (f=myproc()->ofile[fd]) == 0)
+  if((f=fdlookup(myproc()->files, fd)) == 0)
     return -1;
   if(pfd)
     *pfd = fd;
@@ -40,16 +41,7 @@ argfd(int n, int *pfd, struct file **pf)
 static int
 fdalloc(struct file *f)
 {
-  int fd;
-  struct proc *curproc = myproc();
-
-  for(fd = 0; fd < NOFILE; fd++){
-    if(curproc->ofile[fd] == 0){
-      curproc->ofile[fd] = f;
-      return fd;
-    }
-  }
-  return -1;
+  return fdinstall(myproc()->files, f);
 }
 
 int
@@ -60,9 +52,11 @@ sys_dup(void)
 
   if(argfd(0, 0, &f) < 0)
     return -1;
-  if((fd=fdalloc(f)) < 0)
+  // the new descriptor takes over argfd's reference
+  if((fd=fdalloc(f)) < 0){
+    fileclose(f);
     return -1;
-  filedup(f);
+  }
   return fd;
 }
 
@@ -70,24 +64,34 @@ int
 sys_read(void)
 {
   struct file *f;
-  int n;
+  int n, r;
   char *p;
 
-  if(argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || argptr(1, &p, n) < 0)
+  if(argfd(0, 0, &f) < 0)
     return -1;
-  return fileread(f, p, n);
+  if(argint(2, &n) < 0 || argptr(1, &p, n) < 0)
+    r = -1;
+  else
+    r = fileread(f, p, n);
+  fileclose(f);
+  return r;
 }
 
 int
 sys_write(void)
 {
   struct file *f;
-  int n;
+  int n, r;
   char *p;
 
-  if(argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || argptr(1, &p, n) < 0)
+  if(argfd(0, 0, &f) < 0)
     return -1;
-  return filewrite(f, p, n);
+  if(argint(2, &n) < 0 || argptr(1, &p, n) < 0)
+    r = -1;
+  else
+    r = filewrite(f, p, n);
+  fileclose(f);
+  return r;
 }
 
 int
@@ -96,9 +100,9 @@ sys_close(void)
   int fd;
   struct file *f;
 
-  if(argfd(0, &fd, &f) < 0)
+  // another thread may close fd too: only one gets the file
+  if(argint(0, &fd) < 0 || (f = fdremove(myproc()->files, fd)) == 0)
     return -1;
-  myproc()->ofile[fd] = 0;
   fileclose(f);
   return 0;
 }
@@ -108,10 +112,16 @@ sys_fstat(void)
 {
   struct file *f;
   struct stat *st;
+  int r;
 
-  if(argfd(0, 0, &f) < 0 || argptr(1, (void*)&st, sizeof(*st)) < 0)
+  if(argfd(0, 0, &f) < 0)
     return -1;
-  return filestat(f, st);
+  if(argptr(1, (void*)&st, sizeof(*st)) < 0)
+    r = -1;
+  else
+    r = filestat(f, st);
+  fileclose(f);
+  return r;
 }
 
 // Create the path new as a link to the same inode as old.
@@ -387,9 +397,8 @@ sys_chdir(void)
     return -1;
   }
   iunlock(ip);
-  iput(curproc->cwd);
+  iput(fileschdir(curproc->files, ip));
   end_op();
-  curproc->cwd = ip;
   return 0;
 }
 
@@ -459,7 +468,7 @@ sys_pipe(void)
   fd0 = -1;
   if((fd0 = fdalloc(rf)) < 0 || (fd1 = fdalloc(wf)) < 0){
     if(fd0 >= 0)
-      myproc()->ofile[fd0] = 0;
+      fdremove(myproc()->files, fd0);
     fileclose(rf);
     fileclose(wf);
     return -1;
@@ -134,4 +134,28 @@ sys_thread_join(void) {
   if(argint(0, &tid) < 0 || argptr(1, (void*)&retval, sizeof(*retval)) < 0) 
     return -1;  
   return thread_join((thread_t)tid,retval);
-}
\ No newline at end of file
+}
+
+int
+sys_futex_wait(void) {
+  int addr, val;
+  if(argint(0, &addr) < 0 || argint(1, &val) < 0)
+    return -1;
+  return futex_wait((int*)addr, val);
+}
+
+int
+sys_futex_wake(void) {
+  int addr, n;
+  if(argint(0, &addr) < 0 || argint(1, &n) < 0)
+    return -1;
+  return futex_wake((int*)addr, n);
+}
+
+int
+sys_settls(void) {
+  int base;
+  if(argint(0, &base) < 0)
+    return -1;
+  return settls((uint)base);
+}
@@ -0,0 +1,397 @@
+// Thread benchmarks.
+// Results are printed as "key=value" lines so that runs with
+// different kernels or CPUS= settings can be compared by script.
+//
+//   threadbench many [threads]
+//     create threads that all stay alive until the last one
+//     exists, then release and join them. Reports how many
+//     could be created and the ticks spent creating and joining.
+//
+//   threadbench reuse [threads]
+//     create and join threads one at a time and report how much
+//     the address space grew; reused stacks keep it at one slot.
+//
+//   threadbench join [threads] [batch]
+//     create threads in batches of batch and join each batch in
+//     order, so most joins wait while siblings exit. Reports the
+//     ticks and cycles per create/join pair.
+//
+//   threadbench lock [threads] [iters]
+//     threads each take a shared lock iters times to bump a
+//     counter, first with a spin lock, then with a futex-backed
+//     mutex that sleeps when contended. Reports ticks for each.
+//
+//   threadbench tls [threads] [iters]
+//     threads each point %fs at a block on their own stack and
+//     bump a counter in it iters times through tlsself(), with
+//     no locking. bad counts threads that saw another's block.
+//
+//   threadbench pingpong [rounds]
+//     two threads pass a turn back and forth through a futex,
+//     so every round trip is two wakeups and two switches
+//     between threads sharing a page table. Compare its
+//     cycles_per_round with the process pingpong program's.
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "uthread.h"
+
+#define DEF_THREADS 1000
+#define DEF_REUSE   2000
+#define DEF_JOIN    10000
+#define DEF_BATCH   64
+#define DEF_LOCKERS 4
+#define DEF_ITERS   100000
+#define DEF_TLS     4
+#define DEF_ROUNDS  10000
+#define MAXTHREADS  4096
+
+static inline uint64
+rdtsc(void)
+{
+  uint lo, hi;
+
+  asm volatile("rdtsc" : "=a" (lo), "=d" (hi));
+  return ((uint64)hi << 32) | lo;
+}
+
+static inline int
+xchg(volatile int *addr, int newval)
+{
+  int result;
+
+  asm volatile("lock; xchgl %0, %1" :
+               "+m" (*addr), "=a" (result) :
+               "1" (newval) :
+               "cc");
+  return result;
+}
+
+static inline int
+cmpxchg(volatile int *addr, int old, int newval)
+{
+  int result;
+
+  asm volatile("lock; cmpxchgl %2, %1" :
+               "=a" (result), "+m" (*addr) :
+               "r" (newval), "0" (old) :
+               "cc");
+  return result;
+}
+
+thread_t tids[MAXTHREADS];
+int gate[2];    // threads block reading a byte each from gate[0]
+
+void*
+waiter(void *arg)
+{
+  char c;
+
+  read(gate[0], &c, 1);
+  thread_exit(arg);
+  return 0;
+}
+
+void*
+echo(void *arg)
+{
+  thread_exit(arg);
+  return 0;
+}
+
+void
+reuse(int n)
+{
+  void *ret;
+  uint before, after;
+  int i, bad = 0, start, end;
+
+  before = (uint)sbrk(0);
+  start = uptime();
+  for(i = 0; i < n; i++){
+    if(thread_create(&tids[0], echo, (void*)i) < 0){
+      printf(2, "threadbench: thread_create failed\n");
+      break;
+    }
+    if(thread_join(tids[0], &ret) < 0 || (int)ret != i)
+      bad++;
+  }
+  end = uptime();
+  after = (uint)sbrk(0);
+
+  printf(1, "bench=reuse threads=%d ticks=%d grown_kb=%d bad=%d\n",
+         i, end - start, (after - before) / 1024, bad);
+}
+
+void
+join(int n, int batch)
+{
+  void *ret;
+  uint64 t0, t1;
+  int i, k, made = 0, bad = 0, start, end;
+
+  if(batch < 1)
+    batch = 1;
+  if(batch > MAXTHREADS)
+    batch = MAXTHREADS;
+  start = uptime();
+  t0 = rdtsc();
+  while(made < n){
+    for(k = 0; k < batch && made + k < n; k++)
+      if(thread_create(&tids[k], echo, (void*)(made + k)) < 0)
+        break;
+    if(k == 0){
+      printf(2, "threadbench: thread_create failed\n");
+      break;
+    }
+    for(i = 0; i < k; i++)
+      if(thread_join(tids[i], &ret) < 0 || (int)ret != made + i)
+        bad++;
+    made += k;
+  }
+  t1 = rdtsc();
+  end = uptime();
+
+  // no 64-bit division in user space: scale down first
+  printf(1, "bench=join threads=%d batch=%d ticks=%d cycles_per_thread=%d"
+         " bad=%d\n", made, batch, end - start,
+         made ? (uint)((t1 - t0) >> 4) / made * 16 : 0, bad);
+}
+
+// 0 unlocked, 1 locked, 2 locked and maybe waited on
+volatile int lockword;
+volatile int counter;
+int usefutex, iters;
+
+void
+lock(void)
+{
+  int c;
+
+  if(!usefutex){
+    while(xchg(&lockword, 1) != 0)
+      ;
+    return;
+  }
+  if((c = cmpxchg(&lockword, 0, 1)) == 0)
+    return;
+  if(c != 2)
+    c = xchg(&lockword, 2);
+  while(c != 0){
+    futex_wait((int*)&lockword, 2);
+    c = xchg(&lockword, 2);
+  }
+}
+
+void
+unlock(void)
+{
+  if(xchg(&lockword, 0) == 2 && usefutex)
+    futex_wake((int*)&lockword, 1);
+}
+
+void*
+locker(void *arg)
+{
+  int i;
+
+  for(i = 0; i < iters; i++){
+    lock();
+    counter++;
+    unlock();
+  }
+  thread_exit(arg);
+  return 0;
+}
+
+void
+locks(int n, int loops)
+{
+  void *ret;
+  int i, made, start, end;
+
+  if(n > MAXTHREADS)
+    n = MAXTHREADS;
+  iters = loops;
+  for(usefutex = 0; usefutex < 2; usefutex++){
+    lockword = counter = 0;
+    start = uptime();
+    for(made = 0; made < n; made++)
+      if(thread_create(&tids[made], locker, 0) < 0)
+        break;
+    for(i = 0; i < made; i++)
+      thread_join(tids[i], &ret);
+    end = uptime();
+    printf(1, "bench=lock kind=%s threads=%d iters=%d ticks=%d bad=%d\n",
+           usefutex ? "futex" : "spin", made, loops, end - start,
+           counter != made * loops);
+  }
+}
+
+struct tlsblock {
+  struct tlsblock *self;
+  uint count;
+};
+
+void*
+tlsuser(void *arg)
+{
+  struct tlsblock b, *t;
+  int i, bad = 0;
+
+  b.self = &b;
+  b.count = 0;
+  settls(&b);
+  for(i = 0; i < iters; i++){
+    t = tlsself();
+    if(t != &b)
+      bad = 1;
+    t->count++;
+  }
+  if(b.count != iters)
+    bad = 1;
+  thread_exit((void*)bad);
+  return 0;
+}
+
+void
+tls(int n, int loops)
+{
+  void *ret;
+  int i, made, bad = 0, start, end;
+
+  if(n > MAXTHREADS)
+    n = MAXTHREADS;
+  iters = loops;
+  start = uptime();
+  for(made = 0; made < n; made++)
+    if(thread_create(&tids[made], tlsuser, 0) < 0)
+      break;
+  for(i = 0; i < made; i++)
+    if(thread_join(tids[i], &ret) < 0 || ret != 0)
+      bad++;
+  end = uptime();
+
+  printf(1, "bench=tls threads=%d iters=%d ticks=%d bad=%d\n",
+         made, loops, end - start, bad);
+}
+
+volatile int turn;   // whose turn it is in pingpong, 0 or 1
+
+void*
+player(void *arg)
+{
+  int me = (int)arg, i;
+
+  for(i = 0; i < iters; i++){
+    while(turn != me)
+      futex_wait((int*)&turn, !me);
+    turn = !me;
+    futex_wake((int*)&turn, 1);
+  }
+  thread_exit(0);
+  return 0;
+}
+
+void
+pingpong(int rounds)
+{
+  void *ret;
+  uint64 t0, t1;
+  int start, end;
+
+  iters = rounds;
+  turn = 0;
+  start = uptime();
+  t0 = rdtsc();
+  if(thread_create(&tids[0], player, (void*)0) < 0 ||
+     thread_create(&tids[1], player, (void*)1) < 0){
+    printf(2, "threadbench: thread_create failed\n");
+    exit();
+  }
+  thread_join(tids[0], &ret);
+  thread_join(tids[1], &ret);
+  t1 = rdtsc();
+  end = uptime();
+
+  // no 64-bit division in user space: scale down first
+  printf(1, "bench=pingpong rounds=%d ticks=%d cycles_per_round=%d\n",
+         rounds, end - start,
+         rounds > 0 ? (uint)((t1 - t0) >> 4) / rounds * 16 : 0);
+}
+
+void
+many(int n)
+{
+  char buf[64];
+  void *ret;
+  int i, k, made, bad = 0, start, mid, end;
+
+  if(n > MAXTHREADS)
+    n = MAXTHREADS;
+  if(pipe(gate) < 0){
+    printf(2, "threadbench: pipe failed\n");
+    return;
+  }
+
+  start = uptime();
+  for(made = 0; made < n; made++)
+    if(thread_create(&tids[made], waiter, (void*)made) < 0)
+      break;
+  mid = uptime();
+
+  // let them all go, then reap them
+  memset(buf, 0, sizeof(buf));
+  for(i = 0; i < made; i += k){
+    k = made - i < sizeof(buf) ? made - i : sizeof(buf);
+    write(gate[1], buf, k);
+  }
+  for(i = 0; i < made; i++)
+    if(thread_join(tids[i], &ret) < 0 || (int)ret != i)
+      bad++;
+  end = uptime();
+  close(gate[0]);
+  close(gate[1]);
+
+  printf(1, "bench=many threads=%d created=%d create_ticks=%d join_ticks=%d"
+         " bad=%d\n", n, made, mid - start, end - mid, bad);
+}
+
+void
+usage(void)
+{
+  printf(2, "usage: threadbench many [threads]\n");
+  printf(2, "       threadbench reuse [threads]\n");
+  printf(2, "       threadbench join [threads] [batch]\n");
+  printf(2, "       threadbench lock [threads] [iters]\n");
+  printf(2, "       threadbench tls [threads] [iters]\n");
+  printf(2, "       threadbench pingpong [rounds]\n");
+  exit();
+}
+
+int
+main(int argc, char *argv[])
+{
+  if(argc < 2)
+    usage();
+
+  if(strcmp(argv[1], "many") == 0)
+    many(argc > 2 ? atoi(argv[2]) : DEF_THREADS);
+  else if(strcmp(argv[1], "reuse") == 0)
+    reuse(argc > 2 ? atoi(argv[2]) : DEF_REUSE);
+  else if(strcmp(argv[1], "join") == 0)
+    join(argc > 2 ? atoi(argv[2]) : DEF_JOIN,
+         argc > 3 ? atoi(argv[3]) : DEF_BATCH);
+  else if(strcmp(argv[1], "lock") == 0)
+    locks(argc > 2 ? atoi(argv[2]) : DEF_LOCKERS,
+          argc > 3 ? atoi(argv[3]) : DEF_ITERS);
+  else if(strcmp(argv[1], "tls") == 0)
+    tls(argc > 2 ? atoi(argv[2]) : DEF_TLS,
+        argc > 3 ? atoi(argv[3]) : DEF_ITERS);
+  else if(strcmp(argv[1], "pingpong") == 0)
+    pingpong(argc > 2 ? atoi(argv[2]) : DEF_ROUNDS);
+  else
+    usage();
+  exit();
+}
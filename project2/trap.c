@@ -60,6 +60,10 @@ trap(struct trapframe *tf)
     ideintr();
     lapiceoi();
     break;
+  case T_IRQ0 + IRQ_RESCHED:
+    // Woken out of hlt; the scheduler loop looks again.
+    lapiceoi();
+    break;
   case T_IRQ0 + IRQ_IDE+1:
     // Bochs generates spurious IDE1 interrupts.
     break;
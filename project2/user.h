@@ -29,6 +29,9 @@ int printprocesses(void);
 int thread_create(thread_t *thread, void *(*start_routine)(void *), void *arg);
 void thread_exit(void *retval);
 int thread_join(thread_t thread, void **retval);
+int futex_wait(int *addr, int val);
+int futex_wake(int *addr, int n);
+int settls(void *base);
 
 
 // ulib.c
@@ -0,0 +1,370 @@
+// User-level synchronization and a worker pool.
+// Locks stay in user space unless contended, then sleep with
+// futex_wait; see uthread.h.
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "uthread.h"
+
+#define SPINS 100      // tries before a mutex goes to sleep
+
+static inline int
+xchg(volatile int *addr, int newval)
+{
+  int result;
+
+  asm volatile("lock; xchgl %0, %1" :
+               "+m" (*addr), "=a" (result) :
+               "1" (newval) :
+               "cc", "memory");
+  return result;
+}
+
+static inline int
+cmpxchg(volatile int *addr, int old, int newval)
+{
+  int result;
+
+  asm volatile("lock; cmpxchgl %2, %1" :
+               "=a" (result), "+m" (*addr) :
+               "r" (newval), "0" (old) :
+               "cc", "memory");
+  return result;
+}
+
+// Add n to *addr, return the old value.
+static inline int
+fetchadd(volatile int *addr, int n)
+{
+  asm volatile("lock; xaddl %0, %1" :
+               "+r" (n), "+m" (*addr) :
+               :
+               "cc", "memory");
+  return n;
+}
+
+static inline void
+cpupause(void)
+{
+  asm volatile("pause");
+}
+
+void
+mutex_init(struct mutex *m)
+{
+  m->word = 0;
+}
+
+int
+mutex_trylock(struct mutex *m)
+{
+  return cmpxchg(&m->word, 0, 1) == 0;
+}
+
+// Sleep until m is free and take it, leaving it marked
+// contended so that mutex_unlock wakes the next waiter.
+static void
+mutex_sleep(struct mutex *m)
+{
+  while(xchg(&m->word, 2) != 0)
+    futex_wait((int*)&m->word, 2);
+}
+
+void
+mutex_lock(struct mutex *m)
+{
+  int c, i;
+
+  for(i = 0; i < SPINS; i++){
+    if((c = cmpxchg(&m->word, 0, 1)) == 0)
+      return;
+    if(c == 2)
+      break;    // others are asleep already, join them
+    cpupause();
+  }
+  mutex_sleep(m);
+}
+
+void
+mutex_unlock(struct mutex *m)
+{
+  if(xchg(&m->word, 0) == 2)
+    futex_wake((int*)&m->word, 1);
+}
+
+void
+cond_init(struct cond *c)
+{
+  c->seq = 0;
+}
+
+// Release m, sleep until signaled, and take m again.
+// Wakeups can be spurious: callers recheck their condition.
+void
+cond_wait(struct cond *c, struct mutex *m)
+{
+  int seq = c->seq;
+
+  mutex_unlock(m);
+  futex_wait((int*)&c->seq, seq);
+  // a broadcast may wake others with us
+  mutex_sleep(m);
+}
+
+void
+cond_signal(struct cond *c)
+{
+  fetchadd(&c->seq, 1);
+  futex_wake((int*)&c->seq, 1);
+}
+
+void
+cond_broadcast(struct cond *c)
+{
+  fetchadd(&c->seq, 1);
+  futex_wake((int*)&c->seq, 0x7fffffff);
+}
+
+void
+barrier_init(struct barrier *b, int n)
+{
+  mutex_init(&b->lock);
+  cond_init(&b->done);
+  b->n = n;
+  b->count = 0;
+  b->phase = 0;
+}
+
+// Wait until n threads have arrived. Return 1 in the last
+// one to arrive, 0 in the others.
+int
+barrier_wait(struct barrier *b)
+{
+  int phase;
+
+  mutex_lock(&b->lock);
+  phase = b->phase;
+  if(++b->count == b->n){
+    b->count = 0;
+    b->phase++;
+    cond_broadcast(&b->done);
+    mutex_unlock(&b->lock);
+    return 1;
+  }
+  while(b->phase == phase)
+    cond_wait(&b->done, &b->lock);
+  mutex_unlock(&b->lock);
+  return 0;
+}
+
+void
+rwlock_init(struct rwlock *rw)
+{
+  mutex_init(&rw->lock);
+  cond_init(&rw->readers);
+  cond_init(&rw->writers);
+  rw->nreader = 0;
+  rw->writer = 0;
+  rw->nwwait = 0;
+}
+
+void
+rwlock_rdlock(struct rwlock *rw)
+{
+  mutex_lock(&rw->lock);
+  while(rw->writer || rw->nwwait > 0)
+    cond_wait(&rw->readers, &rw->lock);
+  rw->nreader++;
+  mutex_unlock(&rw->lock);
+}
+
+void
+rwlock_wrlock(struct rwlock *rw)
+{
+  mutex_lock(&rw->lock);
+  rw->nwwait++;
+  while(rw->writer || rw->nreader > 0)
+    cond_wait(&rw->writers, &rw->lock);
+  rw->nwwait--;
+  rw->writer = 1;
+  mutex_unlock(&rw->lock);
+}
+
+void
+rwlock_unlock(struct rwlock *rw)
+{
+  int waswriter;
+
+  mutex_lock(&rw->lock);
+  waswriter = rw->writer;
+  if(waswriter)
+    rw->writer = 0;
+  else
+    rw->nreader--;
+  // a waiting writer goes first; readers only wait behind
+  // writers, so they need waking only when one leaves
+  if(rw->nwwait > 0){
+    if(rw->nreader == 0)
+      cond_signal(&rw->writers);
+  } else if(waswriter)
+    cond_broadcast(&rw->readers);
+  mutex_unlock(&rw->lock);
+}
+
+// Take a task for worker self: the newest of its own, else the
+// oldest of another worker's. Return 0 if there are none.
+static int
+take(struct pool *p, int self, struct task *t)
+{
+  struct deque *d;
+  int i, found = 0;
+
+  for(i = 0; !found && i < p->nworker; i++){
+    d = &p->dq[(self + i) % p->nworker];
+    if(d->bottom == d->top)
+      continue;   // looks empty; not worth the lock
+    mutex_lock(&d->lock);
+    if(d->bottom != d->top){
+      if(i == 0)
+        *t = d->t[--d->bottom % POOLDEQ];
+      else
+        *t = d->t[d->top++ % POOLDEQ];
+      found = 1;
+    }
+    mutex_unlock(&d->lock);
+  }
+  if(found)
+    fetchadd(&p->queued, -1);
+  return found;
+}
+
+// A task finished; wake pool_wait if it was the last.
+static void
+finish(struct pool *p)
+{
+  if(fetchadd(&p->pending, -1) == 1){
+    mutex_lock(&p->lock);
+    cond_broadcast(&p->idle);
+    mutex_unlock(&p->lock);
+  }
+}
+
+static void*
+worker(void *arg)
+{
+  struct deque *d = arg;
+  struct pool *p = d->pool;
+  int self = d - p->dq;
+  struct task t;
+  int stop;
+
+  for(;;){
+    if(take(p, self, &t)){
+      t.fn(t.arg);
+      finish(p);
+      continue;
+    }
+    // nsleep goes up before queued is checked, and submitters
+    // bump queued before checking nsleep, so one of the two
+    // sees the other.
+    mutex_lock(&p->lock);
+    fetchadd(&p->nsleep, 1);
+    while(p->queued == 0 && !p->stop)
+      cond_wait(&p->work, &p->lock);
+    fetchadd(&p->nsleep, -1);
+    stop = p->stop && p->queued == 0;
+    mutex_unlock(&p->lock);
+    if(stop)
+      break;
+  }
+  thread_exit(0);
+  return 0;
+}
+
+// Start a pool of nworker threads. Return how many started,
+// or -1 if none could.
+int
+pool_init(struct pool *p, int nworker)
+{
+  int i;
+
+  if(nworker < 1)
+    nworker = 1;
+  if(nworker > POOLMAX)
+    nworker = POOLMAX;
+  memset(p, 0, sizeof(*p));
+  mutex_init(&p->lock);
+  cond_init(&p->work);
+  cond_init(&p->idle);
+  for(i = 0; i < nworker; i++){
+    mutex_init(&p->dq[i].lock);
+    p->dq[i].pool = p;
+  }
+  // workers look at nworker, so count them in as they start
+  for(i = 0; i < nworker; i++){
+    p->nworker = i + 1;
+    if(thread_create(&p->tid[i], worker, &p->dq[i]) < 0){
+      p->nworker = i;
+      break;
+    }
+  }
+  return p->nworker > 0 ? p->nworker : -1;
+}
+
+// Queue fn(arg) on the workers' deques in turn. If they are
+// all full, run it in the caller instead.
+void
+pool_submit(struct pool *p, void (*fn)(void*), void *arg)
+{
+  struct deque *d;
+  int i, k;
+
+  fetchadd(&p->pending, 1);
+  k = fetchadd(&p->next, 1);
+  for(i = 0; i < p->nworker; i++){
+    d = &p->dq[(uint)(k + i) % p->nworker];
+    mutex_lock(&d->lock);
+    if(d->bottom - d->top < POOLDEQ){
+      d->t[d->bottom % POOLDEQ].fn = fn;
+      d->t[d->bottom % POOLDEQ].arg = arg;
+      d->bottom++;
+      mutex_unlock(&d->lock);
+      fetchadd(&p->queued, 1);
+      if(p->nsleep > 0){
+        mutex_lock(&p->lock);
+        cond_signal(&p->work);
+        mutex_unlock(&p->lock);
+      }
+      return;
+    }
+    mutex_unlock(&d->lock);
+  }
+  fn(arg);
+  finish(p);
+}
+
+// Wait until every submitted task has finished.
+void
+pool_wait(struct pool *p)
+{
+  mutex_lock(&p->lock);
+  while(p->pending > 0)
+    cond_wait(&p->idle, &p->lock);
+  mutex_unlock(&p->lock);
+}
+
+// Finish the queued tasks, then stop and join the workers.
+void
+pool_destroy(struct pool *p)
+{
+  void *ret;
+  int i;
+
+  mutex_lock(&p->lock);
+  p->stop = 1;
+  cond_broadcast(&p->work);
+  mutex_unlock(&p->lock);
+  for(i = 0; i < p->nworker; i++)
+    thread_join(p->tid[i], &ret);
+}
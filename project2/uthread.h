@@ -0,0 +1,94 @@
+// User-level synchronization and a worker pool, built on
+// thread_create/thread_join and futex_wait/futex_wake.
+// Include after types.h and user.h.
+
+// Adaptive mutex: spins briefly, then sleeps in the kernel.
+struct mutex {
+  volatile int word;   // 0 unlocked, 1 locked, 2 locked with waiters
+};
+
+// Condition variable; waiters sleep until seq changes.
+struct cond {
+  volatile int seq;
+};
+
+struct barrier {
+  struct mutex lock;
+  struct cond done;
+  int n;               // threads to wait for
+  int count;           // threads arrived in this phase
+  int phase;
+};
+
+// Reader-writer lock; waiting writers keep new readers out.
+struct rwlock {
+  struct mutex lock;
+  struct cond readers;
+  struct cond writers;
+  int nreader;         // readers holding the lock
+  int writer;          // a writer holds the lock
+  int nwwait;          // writers waiting
+};
+
+#define POOLMAX  8     // most workers in a pool
+#define POOLDEQ  256   // tasks each worker can queue
+
+struct task {
+  void (*fn)(void*);
+  void *arg;
+};
+
+// One worker's tasks. The worker takes the newest from the
+// bottom; idle workers steal the oldest from the top.
+struct deque {
+  struct mutex lock;
+  struct pool *pool;
+  uint top, bottom;    // tasks are t[top..bottom-1], mod POOLDEQ
+  struct task t[POOLDEQ];
+};
+
+struct pool {
+  int nworker;
+  thread_t tid[POOLMAX];
+  struct deque dq[POOLMAX];
+  volatile int queued;   // tasks sitting in the deques
+  volatile int pending;  // tasks submitted but not finished
+  volatile int nsleep;   // workers asleep on work
+  volatile int next;     // deque the next task goes to
+  int stop;
+  struct mutex lock;     // guards sleeping on work and idle
+  struct cond work;
+  struct cond idle;
+};
+
+// Thread-local data: a thread passes settls() a block whose
+// first word points to the block itself; tlsself() then
+// returns the block with one %fs-relative load.
+static inline void*
+tlsself(void)
+{
+  void *p;
+
+  asm volatile("movl %%fs:0, %0" : "=r" (p));
+  return p;
+}
+
+// uthread.c
+void mutex_init(struct mutex*);
+void mutex_lock(struct mutex*);
+int mutex_trylock(struct mutex*);
+void mutex_unlock(struct mutex*);
+void cond_init(struct cond*);
+void cond_wait(struct cond*, struct mutex*);
+void cond_signal(struct cond*);
+void cond_broadcast(struct cond*);
+void barrier_init(struct barrier*, int n);
+int barrier_wait(struct barrier*);
+void rwlock_init(struct rwlock*);
+void rwlock_rdlock(struct rwlock*);
+void rwlock_wrlock(struct rwlock*);
+void rwlock_unlock(struct rwlock*);
+int pool_init(struct pool*, int nworker);
+void pool_submit(struct pool*, void (*fn)(void*), void *arg);
+void pool_wait(struct pool*);
+void pool_destroy(struct pool*);
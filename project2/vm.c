@@ -21,12 +21,24 @@ seginit(void)
   // Cannot share a CODE descriptor for both kernel and user
   // because it would have to have DPL_USR, but the CPU forbids
   // an interrupt from CPL=0 to DPL=3.
-  c = &cpus[cpuid()];
+  // %gs is not set up yet, so mycpu() can't be used:
+  // find this cpu by its local APIC ID.
+  for(c = cpus; c < &cpus[ncpu]; c++)
+    if(c->apicid == lapicid())
+      break;
+  if(c == &cpus[ncpu])
+    panic("seginit: unknown apicid");
   c->gdt[SEG_KCODE] = SEG(STA_X|STA_R, 0, 0xffffffff, 0);
   c->gdt[SEG_KDATA] = SEG(STA_W, 0, 0xffffffff, 0);
   c->gdt[SEG_UCODE] = SEG(STA_X|STA_R, 0, 0xffffffff, DPL_USER);
   c->gdt[SEG_UDATA] = SEG(STA_W, 0, 0xffffffff, DPL_USER);
+
+  // Map cpu-local storage, c->self and c->proc, at %gs.
+  c->gdt[SEG_KCPU] = SEG(STA_W, &c->self, 8, 0);
   lgdt(c->gdt, sizeof(c->gdt));
+  loadgs(SEG_KCPU << 3);
+  c->self = c;
+  c->proc = 0;
 }
 
 // Return the address of the PTE in page table pgdir
@@ -152,6 +164,14 @@ switchkvm(void)
   lcr3(V2P(kpgdir));   // switch to the kernel page table
 }
 
+// The generation of p's address space, see lazyswitchuvm.
+static uint
+vmgen(struct proc *p)
+{
+  while(p->isthread) p = p->parent;
+  return p->vmgen;
+}
+
 // Switch TSS and h/w page table to correspond to process p.
 void
 switchuvm(struct proc *p)
@@ -173,7 +193,44 @@ switchuvm(struct proc *p)
   // forbids I/O instructions (e.g., inb and outb) from user space
   mycpu()->ts.iomb = (ushort) 0xFFFF;
   ltr(SEG_TSS << 3);
+  switchtls(p);
   lcr3(V2P(p->pgdir));  // switch to process's address space
+  mycpu()->vmgen = vmgen(p);
+  popcli();
+}
+
+// Like switchuvm, but if %cr3 already holds p's page table,
+// as after running another thread of p's process, only switch
+// the kernel stack and thread-local segment and keep the TLB.
+// Unless pages were unmapped since this cpu loaded it: then
+// the TLB may still map them, so reload after all.
+// For the scheduler; callers that changed the page table use
+// switchuvm, which always reloads %cr3.
+void
+lazyswitchuvm(struct proc *p)
+{
+  if(p->pgdir == 0 || rcr3() != V2P(p->pgdir) ||
+     mycpu()->vmgen != vmgen(p)){
+    switchuvm(p);
+    return;
+  }
+  if(p->kstack == 0)
+    panic("lazyswitchuvm: no kstack");
+
+  pushcli();
+  mycpu()->ts.esp0 = (uint)p->kstack + KSTACKSIZE;
+  switchtls(p);
+  popcli();
+}
+
+// Point this cpu's user %fs segment at p's thread-local data.
+// The segment register is reloaded from the trap frame on the
+// way back to user space.
+void
+switchtls(struct proc *p)
+{
+  pushcli();
+  mycpu()->gdt[SEG_UTLS] = SEG(STA_W, p->tls, 0xffffffff, DPL_USER);
   popcli();
 }
 